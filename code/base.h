@@ -0,0 +1,28 @@
+#ifndef BASE_H
+#define BASE_H
+
+// Basic types and macros shared by the platform layer and the portable modules
+
+#include <stdint.h>
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t   s8;
+typedef int16_t  s16;
+typedef int32_t  s32;
+typedef int64_t  s64;
+typedef float    f32;
+typedef double   f64;
+typedef uint32_t b32;
+
+#define AssertBreak() (*(volatile int *)0 = 0)
+#define Assert(Expression) if(!(Expression)) { AssertBreak(); }
+#define AssertHR(HResult) Assert(SUCCEEDED(HResult))
+#define ArrayCount(Array) (sizeof(Array) / sizeof((Array)[0]))
+
+#define Minimum(A, B) ((A) < (B) ? (A) : (B))
+#define Maximum(A, B) ((A) > (B) ? (A) : (B))
+#define Clamp(Min, Value, Max) Minimum(Maximum((Value), (Min)), (Max))
+
+#endif
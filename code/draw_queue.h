@@ -0,0 +1,435 @@
+#ifndef DRAW_QUEUE_H
+#define DRAW_QUEUE_H
+
+// Draw item queue
+//
+// Every draw is described by a 64-bit sort key and the index of the caller's draw record.
+// Sorting the keys groups draws by layer, pass, pipeline and material, so submission only
+// has to change state where those fields change between neighbouring items.
+//
+// Key layout of opaque passes, most significant bits first:
+//   63..60  Layer     (4 bits)
+//   59..56  Pass      (4 bits)
+//   55..44  Pipeline  (12 bits)
+//   43..24  Material  (20 bits)
+//   23..0   Depth     (24 bits)
+//
+// Translucent passes (Pass >= DrawPass_Translucent) have to blend back to front, so depth
+// moves above the state fields and only draws at equal depth are grouped by state:
+//   63..60  Layer     (4 bits)
+//   59..56  Pass      (4 bits)
+//   55..32  Depth     (24 bits)
+//   31..20  Pipeline  (12 bits)
+//   19..0   Material  (20 bits)
+
+#include "base.h"
+#include "work_queue.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define DRAW_KEY_LAYER_BITS    4
+#define DRAW_KEY_PASS_BITS     4
+#define DRAW_KEY_PIPELINE_BITS 12
+#define DRAW_KEY_MATERIAL_BITS 20
+#define DRAW_KEY_DEPTH_BITS    24
+
+#define DRAW_KEY_DEPTH_SHIFT    0
+#define DRAW_KEY_MATERIAL_SHIFT (DRAW_KEY_DEPTH_SHIFT + DRAW_KEY_DEPTH_BITS)
+#define DRAW_KEY_PIPELINE_SHIFT (DRAW_KEY_MATERIAL_SHIFT + DRAW_KEY_MATERIAL_BITS)
+#define DRAW_KEY_PASS_SHIFT     (DRAW_KEY_PIPELINE_SHIFT + DRAW_KEY_PIPELINE_BITS)
+#define DRAW_KEY_LAYER_SHIFT    (DRAW_KEY_PASS_SHIFT + DRAW_KEY_PASS_BITS)
+
+#define DRAW_KEY_TRANSLUCENT_MATERIAL_SHIFT 0
+#define DRAW_KEY_TRANSLUCENT_PIPELINE_SHIFT (DRAW_KEY_TRANSLUCENT_MATERIAL_SHIFT + DRAW_KEY_MATERIAL_BITS)
+#define DRAW_KEY_TRANSLUCENT_DEPTH_SHIFT    (DRAW_KEY_TRANSLUCENT_PIPELINE_SHIFT + DRAW_KEY_PIPELINE_BITS)
+#define DRAW_KEY_TRANSLUCENT_PASS_SHIFT     DRAW_KEY_PASS_SHIFT
+#define DRAW_KEY_TRANSLUCENT_LAYER_SHIFT    DRAW_KEY_LAYER_SHIFT
+
+typedef enum draw_pass
+{
+    DrawPass_Opaque      = 0,
+    DrawPass_Translucent = 8, // This and every later pass uses the translucent key layout
+} draw_pass;
+
+#define DrawKeyIsTranslucent(Key) ((((Key) >> DRAW_KEY_PASS_SHIFT) & ((1ull << DRAW_KEY_PASS_BITS) - 1)) >= DrawPass_Translucent)
+
+// Extracts a field as stored in the key. DEPTH is the sort value, which translucent keys keep
+// inverted; use DrawKeyDepth for the depth that was passed to DrawKeyPack.
+#define DrawKeyField(Key, Field) (u32)(((Key) >> (DrawKeyIsTranslucent(Key) ? DRAW_KEY_TRANSLUCENT_##Field##_SHIFT : DRAW_KEY_##Field##_SHIFT)) & \
+                                       ((1ull << DRAW_KEY_##Field##_BITS) - 1))
+
+// Depth is the quantized view depth, 0 being nearest. Opaque passes sort it front to back,
+// translucent passes store it inverted so they sort back to front.
+static u64 DrawKeyPack(u32 Layer, u32 Pass, u32 Pipeline, u32 Material, u32 Depth)
+{
+    Assert(Layer    < (1u << DRAW_KEY_LAYER_BITS));
+    Assert(Pass     < (1u << DRAW_KEY_PASS_BITS));
+    Assert(Pipeline < (1u << DRAW_KEY_PIPELINE_BITS));
+    Assert(Material < (1u << DRAW_KEY_MATERIAL_BITS));
+    Assert(Depth    < (1u << DRAW_KEY_DEPTH_BITS));
+
+    u64 Key = ((u64)Layer << DRAW_KEY_LAYER_SHIFT) |
+              ((u64)Pass  << DRAW_KEY_PASS_SHIFT);
+
+    if(Pass >= DrawPass_Translucent)
+    {
+        u32 MaxDepth = (1u << DRAW_KEY_DEPTH_BITS) - 1;
+        Key |= ((u64)(MaxDepth - Depth) << DRAW_KEY_TRANSLUCENT_DEPTH_SHIFT) |
+               ((u64)Pipeline           << DRAW_KEY_TRANSLUCENT_PIPELINE_SHIFT) |
+               ((u64)Material           << DRAW_KEY_TRANSLUCENT_MATERIAL_SHIFT);
+    }
+    else
+    {
+        Key |= ((u64)Pipeline << DRAW_KEY_PIPELINE_SHIFT) |
+               ((u64)Material << DRAW_KEY_MATERIAL_SHIFT) |
+               ((u64)Depth    << DRAW_KEY_DEPTH_SHIFT);
+    }
+    return Key;
+}
+
+// Depth as passed to DrawKeyPack, for either layout
+static u32 DrawKeyDepth(u64 Key)
+{
+    u32 Depth = DrawKeyField(Key, DEPTH);
+    if(DrawKeyIsTranslucent(Key))
+    {
+        u32 MaxDepth = (1u << DRAW_KEY_DEPTH_BITS) - 1;
+        Depth = MaxDepth - Depth;
+    }
+    return Depth;
+}
+
+// Depth in [0, 1], DrawKeyPack picks the sort direction from the pass
+static u32 DrawKeyQuantizeDepth(f32 Depth)
+{
+    u32 MaxDepth = (1u << DRAW_KEY_DEPTH_BITS) - 1;
+    return (u32)(Clamp(0.0f, Depth, 1.0f) * (f32)MaxDepth);
+}
+
+typedef struct draw_item
+{
+    u64 Key;
+    u32 DrawIndex;
+    u32 Reserved;
+} draw_item;
+
+#define RADIX_DIGIT_COUNT 8
+#define RADIX_BUCKET_COUNT 256
+#define RADIX_PARALLEL_MIN_COUNT (64*1024)
+#define RADIX_MAX_JOBS 32
+
+typedef u32 radix_histogram[RADIX_DIGIT_COUNT][RADIX_BUCKET_COUNT];
+
+typedef struct radix_sort_job
+{
+    draw_item *Source;
+    draw_item *Dest;
+    u32 Begin;
+    u32 End;
+    u32 Shift;
+    u32 Counts[RADIX_BUCKET_COUNT];
+    u32 Offsets[RADIX_BUCKET_COUNT];
+    radix_histogram *AllDigits;
+} radix_sort_job;
+
+typedef struct draw_queue
+{
+    draw_item *Items;
+    draw_item *Scratch;
+    u32 Count;
+    u32 Capacity;
+
+    // Per job state of the parallel sort
+    radix_sort_job *Jobs;
+    radix_histogram *JobHistograms;
+} draw_queue;
+
+static void DrawQueueInit(draw_queue *Queue, u32 Capacity)
+{
+    Queue->Items    = (draw_item *)malloc(Capacity * sizeof(draw_item));
+    Queue->Scratch  = (draw_item *)malloc(Capacity * sizeof(draw_item));
+    Queue->Count    = 0;
+    Queue->Capacity = Capacity;
+    Assert(Queue->Items && Queue->Scratch);
+
+    Queue->Jobs          = (radix_sort_job *)malloc(RADIX_MAX_JOBS * sizeof(radix_sort_job));
+    Queue->JobHistograms = (radix_histogram *)malloc(RADIX_MAX_JOBS * sizeof(radix_histogram));
+    Assert(Queue->Jobs && Queue->JobHistograms);
+}
+
+static void DrawQueueFree(draw_queue *Queue)
+{
+    free(Queue->Items);
+    free(Queue->Scratch);
+    free(Queue->Jobs);
+    free(Queue->JobHistograms);
+    Queue->Items         = NULL;
+    Queue->Scratch       = NULL;
+    Queue->Jobs          = NULL;
+    Queue->JobHistograms = NULL;
+    Queue->Count         = 0;
+    Queue->Capacity      = 0;
+}
+
+static void DrawQueueReset(draw_queue *Queue)
+{
+    Queue->Count = 0;
+}
+
+static void DrawQueuePush(draw_queue *Queue, u64 Key, u32 DrawIndex)
+{
+    Assert(Queue->Count < Queue->Capacity);
+    draw_item *Item = Queue->Items + Queue->Count++;
+    Item->Key       = Key;
+    Item->DrawIndex = DrawIndex;
+    Item->Reserved  = 0;
+}
+
+//------------------------------------------------------------------------
+// LSD radix sort, 8 passes of 8 bits.
+// Histograms of all 8 digits are gathered in a single sweep. Digits that are the same for
+// every key (unused layers, passes, high pipeline bits...) leave the order unchanged and
+// their passes are skipped.
+
+static void RadixHistogramAllDigits(draw_item *Items, u32 Begin, u32 End, radix_histogram Histogram)
+{
+    memset(Histogram, 0, sizeof(radix_histogram));
+    for(u32 Index = Begin; Index < End; ++Index)
+    {
+        u64 Key = Items[Index].Key;
+        ++Histogram[0][(Key >>  0) & 0xFF];
+        ++Histogram[1][(Key >>  8) & 0xFF];
+        ++Histogram[2][(Key >> 16) & 0xFF];
+        ++Histogram[3][(Key >> 24) & 0xFF];
+        ++Histogram[4][(Key >> 32) & 0xFF];
+        ++Histogram[5][(Key >> 40) & 0xFF];
+        ++Histogram[6][(Key >> 48) & 0xFF];
+        ++Histogram[7][(Key >> 56) & 0xFF];
+    }
+}
+
+static void RadixHistogramDigit(draw_item *Items, u32 Begin, u32 End, u32 Shift, u32 *Histogram)
+{
+    memset(Histogram, 0, RADIX_BUCKET_COUNT * sizeof(u32));
+    for(u32 Index = Begin; Index < End; ++Index)
+    {
+        ++Histogram[(Items[Index].Key >> Shift) & 0xFF];
+    }
+}
+
+// Offsets holds the first destination index of each bucket and is advanced while scattering
+static void RadixScatter(draw_item *Source, draw_item *Dest, u32 Begin, u32 End, u32 Shift, u32 *Offsets)
+{
+    for(u32 Index = Begin; Index < End; ++Index)
+    {
+        draw_item Item = Source[Index];
+        Dest[Offsets[(Item.Key >> Shift) & 0xFF]++] = Item;
+    }
+}
+
+static b32 RadixDigitIsConstant(u32 *DigitHistogram, u32 Count)
+{
+    for(u32 Bucket = 0; Bucket < RADIX_BUCKET_COUNT; ++Bucket)
+    {
+        if(DigitHistogram[Bucket])
+        {
+            return DigitHistogram[Bucket] == Count;
+        }
+    }
+    return 1;
+}
+
+static void RadixHistogramAllDigitsJob(void *Data)
+{
+    radix_sort_job *Job = (radix_sort_job *)Data;
+    RadixHistogramAllDigits(Job->Source, Job->Begin, Job->End, *Job->AllDigits);
+}
+
+static void RadixHistogramDigitJob(void *Data)
+{
+    radix_sort_job *Job = (radix_sort_job *)Data;
+    RadixHistogramDigit(Job->Source, Job->Begin, Job->End, Job->Shift, Job->Counts);
+}
+
+static void RadixScatterJob(void *Data)
+{
+    radix_sort_job *Job = (radix_sort_job *)Data;
+    RadixScatter(Job->Source, Job->Dest, Job->Begin, Job->End, Job->Shift, Job->Offsets);
+}
+
+static void RadixSortSerial(draw_queue *Queue)
+{
+    radix_histogram Histogram;
+    RadixHistogramAllDigits(Queue->Items, 0, Queue->Count, Histogram);
+
+    for(u32 Digit = 0; Digit < RADIX_DIGIT_COUNT; ++Digit)
+    {
+        if(RadixDigitIsConstant(Histogram[Digit], Queue->Count)) continue;
+
+        u32 Offsets[RADIX_BUCKET_COUNT];
+        u32 Sum = 0;
+        for(u32 Bucket = 0; Bucket < RADIX_BUCKET_COUNT; ++Bucket)
+        {
+            Offsets[Bucket] = Sum;
+            Sum += Histogram[Digit][Bucket];
+        }
+
+        RadixScatter(Queue->Items, Queue->Scratch, 0, Queue->Count, Digit * 8, Offsets);
+
+        draw_item *Swap = Queue->Items;
+        Queue->Items    = Queue->Scratch;
+        Queue->Scratch  = Swap;
+    }
+}
+
+// Each job owns a contiguous chunk of the source. Bucket offsets are laid out bucket major,
+// job minor, so scattering chunks in parallel keeps the sort stable.
+static void RadixSortParallel(draw_queue *Queue, work_queue *WorkQueue, u32 JobCount)
+{
+    radix_sort_job *Jobs = Queue->Jobs;
+    radix_histogram *JobHistograms = Queue->JobHistograms;
+
+    u32 Count = Queue->Count;
+    u32 ChunkSize = (Count + JobCount - 1) / JobCount;
+    for(u32 JobIndex = 0; JobIndex < JobCount; ++JobIndex)
+    {
+        radix_sort_job *Job = Jobs + JobIndex;
+        Job->Begin     = Minimum(JobIndex * ChunkSize, Count);
+        Job->End       = Minimum(Job->Begin + ChunkSize, Count);
+        Job->Source    = Queue->Items;
+        Job->AllDigits = JobHistograms + JobIndex;
+        WorkQueueAdd(WorkQueue, RadixHistogramAllDigitsJob, Job);
+    }
+    WorkQueueCompleteAll(WorkQueue);
+
+    // Totals are permutation invariant, so constant digits can be found from the first sweep
+    radix_histogram Histogram = {0};
+    for(u32 JobIndex = 0; JobIndex < JobCount; ++JobIndex)
+    {
+        for(u32 Digit = 0; Digit < RADIX_DIGIT_COUNT; ++Digit)
+        {
+            for(u32 Bucket = 0; Bucket < RADIX_BUCKET_COUNT; ++Bucket)
+            {
+                Histogram[Digit][Bucket] += JobHistograms[JobIndex][Digit][Bucket];
+            }
+        }
+    }
+
+    b32 FirstPass = 1;
+    for(u32 Digit = 0; Digit < RADIX_DIGIT_COUNT; ++Digit)
+    {
+        if(RadixDigitIsConstant(Histogram[Digit], Count)) continue;
+
+        u32 Shift = Digit * 8;
+        for(u32 JobIndex = 0; JobIndex < JobCount; ++JobIndex)
+        {
+            radix_sort_job *Job = Jobs + JobIndex;
+            Job->Source = Queue->Items;
+            Job->Dest   = Queue->Scratch;
+            Job->Shift  = Shift;
+            if(FirstPass)
+            {
+                // Items have not moved yet, the first sweep already counted this digit per chunk
+                memcpy(Job->Counts, JobHistograms[JobIndex][Digit], sizeof(Job->Counts));
+            }
+            else
+            {
+                WorkQueueAdd(WorkQueue, RadixHistogramDigitJob, Job);
+            }
+        }
+        WorkQueueCompleteAll(WorkQueue);
+        FirstPass = 0;
+
+        u32 Sum = 0;
+        for(u32 Bucket = 0; Bucket < RADIX_BUCKET_COUNT; ++Bucket)
+        {
+            for(u32 JobIndex = 0; JobIndex < JobCount; ++JobIndex)
+            {
+                Jobs[JobIndex].Offsets[Bucket] = Sum;
+                Sum += Jobs[JobIndex].Counts[Bucket];
+            }
+        }
+
+        for(u32 JobIndex = 0; JobIndex < JobCount; ++JobIndex)
+        {
+            WorkQueueAdd(WorkQueue, RadixScatterJob, Jobs + JobIndex);
+        }
+        WorkQueueCompleteAll(WorkQueue);
+
+        draw_item *Swap = Queue->Items;
+        Queue->Items    = Queue->Scratch;
+        Queue->Scratch  = Swap;
+    }
+}
+
+// Stable sort by key. WorkQueue may be NULL, small queues are always sorted on the calling thread.
+static void DrawQueueSort(draw_queue *Queue, work_queue *WorkQueue)
+{
+    u32 JobCount = WorkQueue ? Minimum(WorkQueue->ThreadCount + 1, RADIX_MAX_JOBS) : 1;
+    if(JobCount > 1 && Queue->Count >= RADIX_PARALLEL_MIN_COUNT)
+    {
+        RadixSortParallel(Queue, WorkQueue, JobCount);
+    }
+    else
+    {
+        RadixSortSerial(Queue);
+    }
+}
+
+//------------------------------------------------------------------------
+// Submission walks the sorted items and only emits state changes at key boundaries.
+// A pipeline change also rebinds the material, since the bindings depend on the root signature.
+
+typedef void draw_set_pipeline(void *Context, u32 Pipeline);
+typedef void draw_set_material(void *Context, u32 Material);
+typedef void draw_execute(void *Context, u32 DrawIndex);
+
+typedef struct draw_submit_callbacks
+{
+    void *Context;
+    draw_set_pipeline *SetPipeline;
+    draw_set_material *SetMaterial;
+    draw_execute *Draw;
+} draw_submit_callbacks;
+
+typedef struct draw_submit_stats
+{
+    u32 PipelineChanges;
+    u32 MaterialChanges;
+    u32 Draws;
+} draw_submit_stats;
+
+static draw_submit_stats DrawQueueSubmit(draw_queue *Queue, draw_submit_callbacks *Callbacks)
+{
+    draw_submit_stats Stats = {0};
+
+    u32 CurrentPipeline = 0xFFFFFFFF;
+    u32 CurrentMaterial = 0xFFFFFFFF;
+    for(u32 Index = 0; Index < Queue->Count; ++Index)
+    {
+        draw_item *Item = Queue->Items + Index;
+        u32 Pipeline = DrawKeyField(Item->Key, PIPELINE);
+        u32 Material = DrawKeyField(Item->Key, MATERIAL);
+
+        if(Pipeline != CurrentPipeline)
+        {
+            Callbacks->SetPipeline(Callbacks->Context, Pipeline);
+            CurrentPipeline = Pipeline;
+            CurrentMaterial = 0xFFFFFFFF;
+            ++Stats.PipelineChanges;
+        }
+        if(Material != CurrentMaterial)
+        {
+            Callbacks->SetMaterial(Callbacks->Context, Material);
+            CurrentMaterial = Material;
+            ++Stats.MaterialChanges;
+        }
+
+        Callbacks->Draw(Callbacks->Context, Item->DrawIndex);
+        ++Stats.Draws;
+    }
+
+    return Stats;
+}
+
+#endif
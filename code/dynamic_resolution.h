@@ -0,0 +1,166 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+// Dynamic resolution controller
+//
+// No platform or graphics API dependencies, so it can be driven by recorded frame time
+// traces as well as by live GPU timestamps. Feed it the GPU time of every frame and it
+// returns the per-axis fraction of the full resolution to render the next frame at.
+//
+// GPU cost of a pixel bound frame grows roughly linearly with the pixel count, so the
+// controller works on the rendered area (Scale^2). It is a velocity form PI controller
+// on the relative error Target/Measured - 1, with two pieces of hysteresis on top:
+//  - errors inside the dead band are ignored, so small jitter does not move the resolution
+//  - going up requires RaiseDelay consecutive frames of headroom, going down is immediate
+//
+// GPU timestamps arrive Latency frames after the frame was recorded. After every change of
+// the scale the samples still in flight describe the old resolution, so they are dropped
+// and the history restarts; integrating them would keep pushing in the same direction and
+// overshoot the scale that actually meets the target.
+
+#include "base.h"
+#include <math.h>
+
+#define DYNRES_HISTORY_SIZE 4
+
+typedef struct dynres_controller
+{
+    // Tuning
+    f32 TargetMs;
+    f32 MinScale;
+    f32 MaxScale;
+    f32 Kp;
+    f32 Ki;
+    f32 Deadband;
+    u32 RaiseDelay;
+    u32 Latency;
+    u32 Alignment;
+
+    // State
+    f32 History[DYNRES_HISTORY_SIZE];
+    u32 HistoryCount;
+    u32 HistoryIndex;
+    u32 HeadroomFrames;
+    u32 StaleFrames; // Samples still to come from before the last scale change
+    f32 PreviousError;
+    f32 Area;
+    f32 Scale;
+} dynres_controller;
+
+// Latency is the number of frames between recording a frame and reading its GPU time
+static void DynResInit(dynres_controller *Controller, f32 TargetMs, f32 MinScale, f32 MaxScale, u32 Latency)
+{
+    Assert(TargetMs > 0.0f);
+    Assert(0.0f < MinScale && MinScale <= MaxScale);
+
+    dynres_controller Zero = {0};
+    *Controller = Zero;
+
+    Controller->TargetMs   = TargetMs;
+    Controller->MinScale   = MinScale;
+    Controller->MaxScale   = MaxScale;
+    Controller->Kp         = 0.25f;
+    Controller->Ki         = 0.35f;
+    Controller->Deadband   = 0.05f;
+    Controller->RaiseDelay = 8;
+    Controller->Latency    = Latency;
+    Controller->Alignment  = 8;
+
+    Controller->Scale = MaxScale;
+    Controller->Area  = MaxScale * MaxScale;
+}
+
+// Returns the new per-axis scale
+static f32 DynResUpdate(dynres_controller *Controller, f32 GpuMs)
+{
+    if(GpuMs <= 0.0f)
+    {
+        // Timestamps not available yet (first frames, disjoint query)
+        return Controller->Scale;
+    }
+
+    if(Controller->StaleFrames > 0)
+    {
+        --Controller->StaleFrames;
+        return Controller->Scale;
+    }
+
+    Controller->History[Controller->HistoryIndex] = GpuMs;
+    Controller->HistoryIndex = (Controller->HistoryIndex + 1) % DYNRES_HISTORY_SIZE;
+    if(Controller->HistoryCount < DYNRES_HISTORY_SIZE)
+    {
+        ++Controller->HistoryCount;
+    }
+
+    f32 Average = 0.0f;
+    for(u32 Index = 0; Index < Controller->HistoryCount; ++Index)
+    {
+        Average += Controller->History[Index];
+    }
+    Average /= (f32)Controller->HistoryCount;
+
+    // A spike must be acted on straight away, headroom must be sustained
+    f32 Measured = Maximum(Average, GpuMs);
+
+    f32 Error = Controller->TargetMs / Measured - 1.0f;
+    Error = Clamp(-0.5f, Error, 0.5f);
+
+    if(fabsf(Error) < Controller->Deadband)
+    {
+        Error = 0.0f;
+    }
+
+    if(Error > 0.0f)
+    {
+        ++Controller->HeadroomFrames;
+        if(Controller->HeadroomFrames < Controller->RaiseDelay)
+        {
+            Error = 0.0f;
+        }
+    }
+    else
+    {
+        Controller->HeadroomFrames = 0;
+    }
+
+    f32 Delta = Controller->Kp * (Error - Controller->PreviousError) + Controller->Ki * Error;
+    Controller->PreviousError = Error;
+
+    // When the error of a drop returns to zero, the velocity form P term would take the drop
+    // straight back. Growing the area is reserved for sustained headroom.
+    if(Controller->HeadroomFrames < Controller->RaiseDelay)
+    {
+        Delta = Minimum(Delta, 0.0f);
+    }
+
+    f32 MinArea = Controller->MinScale * Controller->MinScale;
+    f32 MaxArea = Controller->MaxScale * Controller->MaxScale;
+    f32 Area = Clamp(MinArea, Controller->Area * (1.0f + Delta), MaxArea);
+    if(Area != Controller->Area)
+    {
+        Controller->Area  = Area;
+        Controller->Scale = sqrtf(Area);
+
+        Controller->StaleFrames  = Controller->Latency;
+        Controller->HistoryCount = 0;
+        Controller->HistoryIndex = 0;
+    }
+
+    return Controller->Scale;
+}
+
+// Render target size for the current scale, aligned down to Alignment pixels
+static void DynResGetRenderSize(dynres_controller *Controller, u32 FullX, u32 FullY, u32 *RenderX, u32 *RenderY)
+{
+    u32 Alignment = Controller->Alignment ? Controller->Alignment : 1;
+
+    u32 X = (u32)((f32)FullX * Controller->Scale);
+    u32 Y = (u32)((f32)FullY * Controller->Scale);
+    X -= X % Alignment;
+    Y -= Y % Alignment;
+
+    *RenderX = Clamp(Alignment, X, FullX);
+    *RenderY = Clamp(Alignment, Y, FullY);
+}
+
+#endif
@@ -0,0 +1,445 @@
+#ifndef FENCE_SERVICE_H
+#define FENCE_SERVICE_H
+
+// Fence completion service
+//
+// Subsystems register "fence reached value N" callbacks instead of blocking on the fence
+// themselves. A single waiter thread sleeps until the lowest registered value of any fence
+// has been reached, then runs the due callbacks in value order (registration order for equal
+// values). Callbacks run on the waiter thread with no locks held; they may register further
+// callbacks but must not call FenceServiceWait.
+//
+// Registrations are kept in a binary min-heap per fence, keyed by fence value. The heap and
+// the dispatcher are portable; only the sleep differs per platform:
+//  - Win32: each fence is an ID3D12Fence, the waiter arms SetEventOnCompletion for the heap
+//    top of every fence and sleeps in WaitForMultipleObjects together with a wake event.
+//    d3d12.h (with COBJMACROS) has to be included before this file.
+//  - Elsewhere: fences are software fences advanced with FenceServiceSignal, the waiter
+//    sleeps on a condition variable.
+
+#include "base.h"
+#include "threading.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FENCE_SERVICE_MAX_FENCES 8
+#define FENCE_SERVICE_DISPATCH_BATCH 64
+
+typedef void fence_callback(void *Data, u64 CompletedValue);
+
+typedef struct fence_callback_entry
+{
+    u64 Value;
+    u64 Sequence; // Ties equal values so callbacks run in registration order
+    fence_callback *Callback; // NULL for entries added by FenceServiceWait
+    void *Data;
+} fence_callback_entry;
+
+typedef struct fence_heap
+{
+    fence_callback_entry *Entries;
+    u32 Count;
+    u32 Capacity;
+} fence_heap;
+
+typedef struct fence_service_fence
+{
+    fence_heap Heap;
+    u64 DispatchedValue; // Every callback up to this value has run
+    u32 InFlightCount;   // Entries popped into the batch that is running right now
+    u64 InFlightLowest;  // Lowest value among them, valid while InFlightCount is not zero
+#if defined(_WIN32)
+    ID3D12Fence *Fence;
+    HANDLE Event;
+    u64 ArmedValue; // Value the event was last armed for, avoids piling up registrations
+#else
+    u64 SignaledValue;
+#endif
+} fence_service_fence;
+
+typedef struct fence_service
+{
+    platform_mutex Mutex;
+    platform_condvar Dispatched;
+#if defined(_WIN32)
+    HANDLE WakeEvent;
+#else
+    platform_condvar WakeWaiter;
+#endif
+    platform_thread Thread;
+    b32 Quit;
+
+    u64 NextSequence;
+    u32 CallbackCapacity;
+    u32 FenceCount;
+    fence_service_fence Fences[FENCE_SERVICE_MAX_FENCES];
+
+    u64 DispatchCount;
+} fence_service;
+
+//------------------------------------------------------------------------
+// - Min-heap keyed by fence value
+
+static b32 FenceEntryLess(fence_callback_entry *A, fence_callback_entry *B)
+{
+    return (A->Value < B->Value) || (A->Value == B->Value && A->Sequence < B->Sequence);
+}
+
+static void FenceHeapInit(fence_heap *Heap, u32 Capacity)
+{
+    Heap->Entries  = (fence_callback_entry *)malloc(Capacity * sizeof(fence_callback_entry));
+    Heap->Count    = 0;
+    Heap->Capacity = Capacity;
+    Assert(Heap->Entries);
+}
+
+static void FenceHeapFree(fence_heap *Heap)
+{
+    free(Heap->Entries);
+    Heap->Entries  = NULL;
+    Heap->Count    = 0;
+    Heap->Capacity = 0;
+}
+
+static void FenceHeapPush(fence_heap *Heap, fence_callback_entry Entry)
+{
+    Assert(Heap->Count < Heap->Capacity && "Fence callback heap is full");
+
+    u32 Index = Heap->Count++;
+    while(Index > 0)
+    {
+        u32 Parent = (Index - 1) / 2;
+        if(!FenceEntryLess(&Entry, Heap->Entries + Parent)) break;
+
+        Heap->Entries[Index] = Heap->Entries[Parent];
+        Index = Parent;
+    }
+    Heap->Entries[Index] = Entry;
+}
+
+static fence_callback_entry FenceHeapPop(fence_heap *Heap)
+{
+    Assert(Heap->Count > 0);
+
+    fence_callback_entry Result = Heap->Entries[0];
+    fence_callback_entry Last   = Heap->Entries[--Heap->Count];
+
+    u32 Index = 0;
+    for(;;)
+    {
+        u32 Child = 2 * Index + 1;
+        if(Child >= Heap->Count) break;
+
+        if(Child + 1 < Heap->Count && FenceEntryLess(Heap->Entries + Child + 1, Heap->Entries + Child))
+        {
+            ++Child;
+        }
+        if(!FenceEntryLess(Heap->Entries + Child, &Last)) break;
+
+        Heap->Entries[Index] = Heap->Entries[Child];
+        Index = Child;
+    }
+    if(Heap->Count > 0)
+    {
+        Heap->Entries[Index] = Last;
+    }
+    return Result;
+}
+
+//------------------------------------------------------------------------
+// - Platform specific fence access, all called with the mutex held
+
+#if defined(_WIN32)
+
+static u64 FenceServiceCompletedValue(fence_service_fence *Fence)
+{
+    return ID3D12Fence_GetCompletedValue(Fence->Fence);
+}
+
+static void FenceServiceWakeWaiter(fence_service *Service)
+{
+    SetEvent(Service->WakeEvent);
+}
+
+// Sleeps until a fence may have reached its heap top or the waiter has been woken.
+// Wake and fence events are auto-reset and stay signaled until waited on, so nothing set
+// between unlocking and waiting is lost; stale fence events only cause an extra pass.
+static void FenceServiceSleep(fence_service *Service)
+{
+    HANDLE Handles[FENCE_SERVICE_MAX_FENCES + 1];
+    u32 HandleCount = 0;
+    Handles[HandleCount++] = Service->WakeEvent;
+
+    for(u32 FenceIndex = 0; FenceIndex < Service->FenceCount; ++FenceIndex)
+    {
+        fence_service_fence *Fence = Service->Fences + FenceIndex;
+        if(Fence->Heap.Count == 0) continue;
+
+        u64 Value = Fence->Heap.Entries[0].Value;
+        if(Value != Fence->ArmedValue)
+        {
+            HRESULT Result = ID3D12Fence_SetEventOnCompletion(Fence->Fence, Value, Fence->Event);
+            AssertHR(Result);
+            Fence->ArmedValue = Value;
+        }
+        Handles[HandleCount++] = Fence->Event;
+    }
+
+    PlatformMutexUnlock(&Service->Mutex);
+    WaitForMultipleObjects(HandleCount, Handles, FALSE, INFINITE);
+    PlatformMutexLock(&Service->Mutex);
+}
+
+#else
+
+static u64 FenceServiceCompletedValue(fence_service_fence *Fence)
+{
+    return Fence->SignaledValue;
+}
+
+static void FenceServiceWakeWaiter(fence_service *Service)
+{
+    PlatformCondvarSignal(&Service->WakeWaiter);
+}
+
+static void FenceServiceSleep(fence_service *Service)
+{
+    PlatformCondvarWait(&Service->WakeWaiter, &Service->Mutex);
+}
+
+#endif
+
+//------------------------------------------------------------------------
+// - Dispatcher
+
+PLATFORM_THREAD_PROC(FenceServiceThreadProc)
+{
+    fence_service *Service = (fence_service *)Parameter;
+    fence_callback_entry Batch[FENCE_SERVICE_DISPATCH_BATCH];
+    u64 CompletedValue[FENCE_SERVICE_MAX_FENCES];
+    u32 FirstFence = 0;
+
+    PlatformMutexLock(&Service->Mutex);
+    for(;;)
+    {
+        // Pop everything that is due. Entries that did not fit into the batch are picked up
+        // again on the next pass, before the waiter goes to sleep. The first fence rotates
+        // so a busy fence cannot keep the others out of a full batch.
+        u32 BatchCount = 0;
+        u32 FenceCount = Service->FenceCount;
+        for(u32 FenceStep = 0; FenceStep < FenceCount; ++FenceStep)
+        {
+            u32 FenceIndex = (FirstFence + FenceStep) % FenceCount;
+            fence_service_fence *Fence = Service->Fences + FenceIndex;
+            u64 Completed = FenceServiceCompletedValue(Fence);
+
+            while(Fence->Heap.Count > 0 && Fence->Heap.Entries[0].Value <= Completed && BatchCount < ArrayCount(Batch))
+            {
+                // Pops come out in value order, so the first one is the lowest
+                if(Fence->InFlightCount++ == 0)
+                {
+                    Fence->InFlightLowest = Fence->Heap.Entries[0].Value;
+                }
+                Batch[BatchCount++] = FenceHeapPop(&Fence->Heap);
+            }
+            CompletedValue[FenceIndex] = Completed;
+        }
+        FirstFence = FenceCount ? (FirstFence + 1) % FenceCount : 0;
+
+        if(BatchCount == 0)
+        {
+            if(Service->Quit) break;
+
+            FenceServiceSleep(Service);
+            continue;
+        }
+
+        PlatformMutexUnlock(&Service->Mutex);
+        for(u32 EntryIndex = 0; EntryIndex < BatchCount; ++EntryIndex)
+        {
+            fence_callback_entry *Entry = Batch + EntryIndex;
+            if(Entry->Callback)
+            {
+                Entry->Callback(Entry->Data, Entry->Value);
+            }
+        }
+        PlatformMutexLock(&Service->Mutex);
+
+        // Values are only published once their callbacks have run, FenceServiceWait relies on it.
+        // Anything still queued at or below the completed value (left over from a full batch or
+        // registered while dispatching) holds the published value back.
+        for(u32 FenceIndex = 0; FenceIndex < FenceCount; ++FenceIndex)
+        {
+            fence_service_fence *Fence = Service->Fences + FenceIndex;
+            u64 Dispatched = CompletedValue[FenceIndex];
+            if(Fence->Heap.Count > 0 && Fence->Heap.Entries[0].Value <= Dispatched)
+            {
+                Dispatched = Fence->Heap.Entries[0].Value - 1;
+            }
+            Fence->DispatchedValue = Maximum(Fence->DispatchedValue, Dispatched);
+            Fence->InFlightCount = 0;
+        }
+        Service->DispatchCount += BatchCount;
+        PlatformCondvarBroadcast(&Service->Dispatched);
+    }
+    PlatformMutexUnlock(&Service->Mutex);
+
+    PLATFORM_THREAD_PROC_END();
+}
+
+// CallbackCapacity is the maximum number of outstanding registrations per fence
+static void FenceServiceInit(fence_service *Service, u32 CallbackCapacity)
+{
+    memset(Service, 0, sizeof(*Service));
+    Service->CallbackCapacity = CallbackCapacity;
+
+    PlatformMutexInit(&Service->Mutex);
+    PlatformCondvarInit(&Service->Dispatched);
+#if defined(_WIN32)
+    Service->WakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    Assert(Service->WakeEvent);
+#else
+    PlatformCondvarInit(&Service->WakeWaiter);
+#endif
+
+    PlatformThreadCreate(&Service->Thread, FenceServiceThreadProc, Service);
+}
+
+// Fences are added before they are used from other threads, returns the ID to register against
+#if defined(_WIN32)
+static u32 FenceServiceAddFence(fence_service *Service, ID3D12Fence *D3DFence)
+#else
+static u32 FenceServiceAddFence(fence_service *Service)
+#endif
+{
+    PlatformMutexLock(&Service->Mutex);
+    Assert(Service->FenceCount < FENCE_SERVICE_MAX_FENCES);
+
+    u32 FenceID = Service->FenceCount++;
+    fence_service_fence *Fence = Service->Fences + FenceID;
+    FenceHeapInit(&Fence->Heap, Service->CallbackCapacity);
+#if defined(_WIN32)
+    Fence->Fence = D3DFence;
+    Fence->Event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    Assert(Fence->Event);
+    Fence->DispatchedValue = ID3D12Fence_GetCompletedValue(D3DFence);
+#endif
+
+    PlatformMutexUnlock(&Service->Mutex);
+    return FenceID;
+}
+
+// Must be called with the mutex held
+static void FenceServicePushLocked(fence_service *Service, u32 FenceID, u64 Value, fence_callback *Callback, void *Data)
+{
+    Assert(FenceID < Service->FenceCount);
+    fence_service_fence *Fence = Service->Fences + FenceID;
+    fence_heap *Heap = &Fence->Heap;
+
+    // A value that has already been dispatched is no longer fully dispatched
+    if(Value <= Fence->DispatchedValue)
+    {
+        Fence->DispatchedValue = Value ? Value - 1 : 0;
+    }
+
+    fence_callback_entry Entry = {
+        .Value    = Value,
+        .Sequence = Service->NextSequence++,
+        .Callback = Callback,
+        .Data     = Data,
+    };
+    FenceHeapPush(Heap, Entry);
+
+    // Only a new heap top changes what the waiter is sleeping on
+    if(Heap->Entries[0].Sequence == Entry.Sequence)
+    {
+        FenceServiceWakeWaiter(Service);
+    }
+}
+
+// Callback runs on the waiter thread once the fence has reached Value. A value that has
+// already been reached is dispatched on the waiter's next pass, never on the calling thread.
+static void FenceServiceRegister(fence_service *Service, u32 FenceID, u64 Value, fence_callback *Callback, void *Data)
+{
+    Assert(Callback);
+    PlatformMutexLock(&Service->Mutex);
+    FenceServicePushLocked(Service, FenceID, Value, Callback, Data);
+    PlatformMutexUnlock(&Service->Mutex);
+}
+
+// Blocks until the fence has reached Value and every callback registered up to Value has run.
+// Returns immediately when that is already the case. When the fence has already reached Value
+// and nothing up to Value is queued or being dispatched, the waiter thread is not involved:
+// the dispatched value is raised here and the call returns without a round trip.
+static void FenceServiceWait(fence_service *Service, u32 FenceID, u64 Value)
+{
+    PlatformMutexLock(&Service->Mutex);
+    Assert(FenceID < Service->FenceCount);
+    fence_service_fence *Fence = Service->Fences + FenceID;
+    if(Fence->DispatchedValue < Value)
+    {
+        b32 NothingQueued   = (Fence->Heap.Count == 0 || Fence->Heap.Entries[0].Value > Value);
+        b32 NothingInFlight = (Fence->InFlightCount == 0 || Fence->InFlightLowest > Value);
+        if(NothingQueued && NothingInFlight && FenceServiceCompletedValue(Fence) >= Value)
+        {
+            Fence->DispatchedValue = Value;
+        }
+    }
+    if(Fence->DispatchedValue < Value)
+    {
+        FenceServicePushLocked(Service, FenceID, Value, NULL, NULL);
+        while(Fence->DispatchedValue < Value)
+        {
+            PlatformCondvarWait(&Service->Dispatched, &Service->Mutex);
+        }
+    }
+    PlatformMutexUnlock(&Service->Mutex);
+}
+
+#if !defined(_WIN32)
+// Advances a software fence, the portable stand-in for a GPU queue signaling its fence
+static void FenceServiceSignal(fence_service *Service, u32 FenceID, u64 Value)
+{
+    PlatformMutexLock(&Service->Mutex);
+    Assert(FenceID < Service->FenceCount);
+    fence_service_fence *Fence = Service->Fences + FenceID;
+    Assert(Value >= Fence->SignaledValue && "Fence values must not go backwards");
+    Fence->SignaledValue = Value;
+
+    if(Fence->Heap.Count > 0 && Fence->Heap.Entries[0].Value <= Value)
+    {
+        FenceServiceWakeWaiter(Service);
+    }
+    PlatformMutexUnlock(&Service->Mutex);
+}
+#endif
+
+// Callbacks still registered for values that were never reached are dropped
+static void FenceServiceShutdown(fence_service *Service)
+{
+    PlatformMutexLock(&Service->Mutex);
+    Service->Quit = 1;
+    FenceServiceWakeWaiter(Service);
+    PlatformMutexUnlock(&Service->Mutex);
+
+    PlatformThreadJoin(&Service->Thread);
+
+    for(u32 FenceIndex = 0; FenceIndex < Service->FenceCount; ++FenceIndex)
+    {
+        fence_service_fence *Fence = Service->Fences + FenceIndex;
+        FenceHeapFree(&Fence->Heap);
+#if defined(_WIN32)
+        CloseHandle(Fence->Event);
+#endif
+    }
+
+#if defined(_WIN32)
+    CloseHandle(Service->WakeEvent);
+#else
+    PlatformCondvarDestroy(&Service->WakeWaiter);
+#endif
+    PlatformCondvarDestroy(&Service->Dispatched);
+    PlatformMutexDestroy(&Service->Mutex);
+}
+
+#endif
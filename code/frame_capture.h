@@ -0,0 +1,341 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+// Asynchronous frame capture
+//
+// A ring of readback slots. Each frame the render thread acquires a free slot and records a
+// copy of the back buffer into it; when the slot's fence value has been reached, the slot is
+// handed to a worker to encode. Nothing on the render thread waits for the GPU or for the
+// encoders: when every slot is still busy the frame is dropped and counted instead.
+//
+// Slots retire in acquisition order. Workers finish encoding in any order, but output is
+// written in frame order by whichever worker completes the oldest outstanding slot, so
+// stream formats (raw, Y4M) stay ordered without a dedicated writer thread. File writes
+// happen under their own lock, the render thread only ever contends on slot state (and on
+// the write lock once, when capture is switched off).
+//
+// Stream formats (raw, Y4M) have a fixed frame rate, the one passed to FrameCaptureInit, so
+// every dropped frame repeats the last frame written instead of silently shortening the
+// recording. PNG files are named by frame number, drops show up as gaps in the numbering.
+//
+// Slot pixel memory is supplied by the caller, e.g. a persistently mapped readback buffer.
+
+#include "base.h"
+#include "threading.h"
+#include "work_queue.h"
+#include "image_encode.h"
+#include <stdio.h>
+
+#define CAPTURE_RING_SIZE 4
+
+typedef enum capture_format
+{
+    CaptureFormat_Raw,
+    CaptureFormat_Y4M,
+    CaptureFormat_PNG,
+} capture_format;
+
+typedef enum capture_slot_state
+{
+    CaptureSlot_Free,
+    CaptureSlot_Pending,  // GPU copy in flight
+    CaptureSlot_Encoding, // Queued on or running in a worker
+    CaptureSlot_Encoded,  // Waiting for older slots to be written
+} capture_slot_state;
+
+typedef struct frame_capture frame_capture;
+
+typedef struct capture_slot
+{
+    frame_capture *Capture;
+    capture_slot_state State;
+    u64 FenceValue;
+    u64 FrameNumber;
+    u32 DroppedBefore; // Frames dropped between the previous captured frame and this one
+    u32 DroppedAfter;  // Frames dropped after this one when capture stopped, set under WriteMutex
+    u8 *Pixels;
+    encode_buffer Output;
+    encode_buffer Scratch;
+} capture_slot;
+
+struct frame_capture
+{
+    platform_mutex Mutex;      // Slot states and ring indices
+    platform_mutex WriteMutex; // Output files and WriteIndex, held while writing so Mutex never is
+    work_queue *WorkQueue;
+
+    capture_format Format;
+    const char *PathPrefix;
+    FILE *Stream; // Raw and Y4M write a single stream, PNG writes a file per frame
+    encode_buffer LastFrame; // Last frame written to the stream, swapped out of its slot
+
+    u32 Width;
+    u32 Height;
+    u32 Pitch;
+    u32 FramesPerSecond;
+
+    capture_slot Slots[CAPTURE_RING_SIZE];
+    u32 AcquireIndex; // Next slot to record a copy into
+    u32 RetireIndex;  // Oldest slot waiting for the GPU
+    u32 WriteIndex;   // Oldest slot waiting to be written out
+
+    u32 CapturedFrames;
+    u32 DroppedFrames;
+    u32 PendingDrops; // Dropped since the last submitted slot, render thread only
+};
+
+// FramesPerSecond is the rate frames are acquired at, i.e. the presentation rate
+static void FrameCaptureInit(frame_capture *Capture, work_queue *WorkQueue, capture_format Format, const char *PathPrefix,
+                             u32 FramesPerSecond, u32 Width, u32 Height, u32 Pitch, u8 *SlotMemory[CAPTURE_RING_SIZE])
+{
+    memset(Capture, 0, sizeof(*Capture));
+    PlatformMutexInit(&Capture->Mutex);
+    PlatformMutexInit(&Capture->WriteMutex);
+
+    Capture->WorkQueue  = WorkQueue;
+    Capture->Format     = Format;
+    Capture->PathPrefix = PathPrefix;
+    Capture->Width      = Width;
+    Capture->Height     = Height;
+    Capture->Pitch      = Pitch;
+    Capture->FramesPerSecond = FramesPerSecond;
+
+    for(u32 SlotIndex = 0; SlotIndex < CAPTURE_RING_SIZE; ++SlotIndex)
+    {
+        Capture->Slots[SlotIndex].Capture = Capture;
+        Capture->Slots[SlotIndex].Pixels  = SlotMemory[SlotIndex];
+    }
+
+    ImageEncodeInit();
+}
+
+// Output file is opened lazily, so a capture that never records anything leaves no file behind
+static void FrameCaptureOpenStream(frame_capture *Capture)
+{
+    if(Capture->Format == CaptureFormat_PNG || Capture->Stream) return;
+
+    char Path[512];
+    snprintf(Path, sizeof(Path), "%s.%s", Capture->PathPrefix, Capture->Format == CaptureFormat_Y4M ? "y4m" : "rgba");
+    Capture->Stream = fopen(Path, "wb");
+    Assert(Capture->Stream && "Failed to open capture stream");
+
+    if(Capture->Format == CaptureFormat_Y4M)
+    {
+        encode_buffer Header = {0};
+        EncodeY4MHeader(&Header, Capture->Width, Capture->Height, Capture->FramesPerSecond);
+        fwrite(Header.Data, 1, Header.Size, Capture->Stream);
+        EncodeBufferFree(&Header);
+    }
+}
+
+// Must be called with the write mutex held. Drops before the first written frame have
+// nothing to repeat and are left out.
+static void FrameCaptureRepeatLastFrame(frame_capture *Capture, u32 Count)
+{
+    if(!Capture->Stream || Capture->LastFrame.Size == 0) return;
+
+    for(u32 Repeat = 0; Repeat < Count; ++Repeat)
+    {
+        fwrite(Capture->LastFrame.Data, 1, Capture->LastFrame.Size, Capture->Stream);
+    }
+}
+
+// Must be called with the write mutex held
+static void FrameCaptureWriteSlot(frame_capture *Capture, capture_slot *Slot)
+{
+    if(Capture->Format == CaptureFormat_PNG)
+    {
+        char Path[512];
+        snprintf(Path, sizeof(Path), "%s_%06llu.png", Capture->PathPrefix, (unsigned long long)Slot->FrameNumber);
+        FILE *File = fopen(Path, "wb");
+        Assert(File && "Failed to open capture file");
+        fwrite(Slot->Output.Data, 1, Slot->Output.Size, File);
+        fclose(File);
+    }
+    else
+    {
+        FrameCaptureOpenStream(Capture);
+        FrameCaptureRepeatLastFrame(Capture, Slot->DroppedBefore);
+        fwrite(Slot->Output.Data, 1, Slot->Output.Size, Capture->Stream);
+
+        // The slot is freed right after this, so its output is kept by swapping buffers
+        // rather than copied. The slot encodes into the previous last frame next time.
+        encode_buffer Swap = Capture->LastFrame;
+        Capture->LastFrame = Slot->Output;
+        Slot->Output = Swap;
+
+        FrameCaptureRepeatLastFrame(Capture, Slot->DroppedAfter);
+        Slot->DroppedAfter = 0;
+    }
+    ++Capture->CapturedFrames;
+}
+
+static void FrameCaptureEncodeJob(void *Data)
+{
+    capture_slot *Slot = (capture_slot *)Data;
+    frame_capture *Capture = Slot->Capture;
+
+    Slot->Output.Size = 0;
+    switch(Capture->Format)
+    {
+        case CaptureFormat_Raw:
+        {
+            EncodeRaw(&Slot->Output, Slot->Pixels, Capture->Width, Capture->Height, Capture->Pitch);
+            break;
+        }
+        case CaptureFormat_Y4M:
+        {
+            EncodeY4MFrame(&Slot->Output, Slot->Pixels, Capture->Width, Capture->Height, Capture->Pitch);
+            break;
+        }
+        case CaptureFormat_PNG:
+        {
+            EncodePNG(&Slot->Output, &Slot->Scratch, Slot->Pixels, Capture->Width, Capture->Height, Capture->Pitch, 0);
+            break;
+        }
+    }
+
+    PlatformMutexLock(&Capture->Mutex);
+    Slot->State = CaptureSlot_Encoded;
+    PlatformMutexUnlock(&Capture->Mutex);
+
+    // State is published before taking the write lock, so a worker that gives up on this
+    // slot below is always followed by this one re-checking it
+    PlatformMutexLock(&Capture->WriteMutex);
+    for(;;)
+    {
+        capture_slot *Oldest = Capture->Slots + Capture->WriteIndex;
+
+        PlatformMutexLock(&Capture->Mutex);
+        b32 Encoded = (Oldest->State == CaptureSlot_Encoded);
+        PlatformMutexUnlock(&Capture->Mutex);
+
+        if(!Encoded) break;
+
+        FrameCaptureWriteSlot(Capture, Oldest);
+        Capture->WriteIndex = (Capture->WriteIndex + 1) % CAPTURE_RING_SIZE;
+
+        PlatformMutexLock(&Capture->Mutex);
+        Oldest->State = CaptureSlot_Free;
+        PlatformMutexUnlock(&Capture->Mutex);
+    }
+    PlatformMutexUnlock(&Capture->WriteMutex);
+}
+
+// Returns the slot to copy this frame into, or -1 when the frame has to be dropped
+static s32 FrameCaptureAcquire(frame_capture *Capture)
+{
+    s32 Result = -1;
+    PlatformMutexLock(&Capture->Mutex);
+    if(Capture->Slots[Capture->AcquireIndex].State == CaptureSlot_Free)
+    {
+        Result = (s32)Capture->AcquireIndex;
+    }
+    else
+    {
+        ++Capture->DroppedFrames;
+        ++Capture->PendingDrops;
+    }
+    PlatformMutexUnlock(&Capture->Mutex);
+    return Result;
+}
+
+// The copy into the slot has been submitted and completes when the fence reaches FenceValue
+static void FrameCaptureSubmit(frame_capture *Capture, s32 SlotIndex, u64 FenceValue, u64 FrameNumber)
+{
+    Assert(SlotIndex == (s32)Capture->AcquireIndex);
+    capture_slot *Slot = Capture->Slots + SlotIndex;
+
+    PlatformMutexLock(&Capture->Mutex);
+    Slot->State         = CaptureSlot_Pending;
+    Slot->FenceValue    = FenceValue;
+    Slot->FrameNumber   = FrameNumber;
+    Slot->DroppedBefore = Capture->PendingDrops;
+    PlatformMutexUnlock(&Capture->Mutex);
+
+    Capture->PendingDrops = 0;
+
+    Capture->AcquireIndex = (Capture->AcquireIndex + 1) % CAPTURE_RING_SIZE;
+}
+
+// Hands every slot whose copy has completed over to the encoders, returns how many were queued.
+// May run on a different thread than Acquire and Submit (e.g. from a fence callback), but only
+// on one thread at a time.
+static u32 FrameCaptureRetire(frame_capture *Capture, u64 CompletedFenceValue)
+{
+    u32 Retired = 0;
+    for(;;)
+    {
+        capture_slot *Slot = Capture->Slots + Capture->RetireIndex;
+
+        PlatformMutexLock(&Capture->Mutex);
+        b32 Ready = (Slot->State == CaptureSlot_Pending && Slot->FenceValue <= CompletedFenceValue);
+        if(Ready)
+        {
+            Slot->State = CaptureSlot_Encoding;
+        }
+        PlatformMutexUnlock(&Capture->Mutex);
+
+        if(!Ready) break;
+
+        WorkQueueAdd(Capture->WorkQueue, FrameCaptureEncodeJob, Slot);
+        Capture->RetireIndex = (Capture->RetireIndex + 1) % CAPTURE_RING_SIZE;
+        ++Retired;
+    }
+    return Retired;
+}
+
+// Call when capturing is switched off. Frames dropped since the last submitted slot are still
+// part of the recording: they are written now if that slot has been written already, and
+// otherwise right after it. Nothing is left over to be charged to the next capture session.
+static void FrameCaptureStop(frame_capture *Capture)
+{
+    PlatformMutexLock(&Capture->WriteMutex);
+
+    capture_slot *Last = Capture->Slots + (Capture->AcquireIndex + CAPTURE_RING_SIZE - 1) % CAPTURE_RING_SIZE;
+    PlatformMutexLock(&Capture->Mutex);
+    b32 Written = (Last->State == CaptureSlot_Free);
+    PlatformMutexUnlock(&Capture->Mutex);
+
+    // A slot that is not written yet will be by a worker holding the write lock, after this
+    if(Written)
+    {
+        FrameCaptureRepeatLastFrame(Capture, Capture->PendingDrops);
+    }
+    else
+    {
+        Last->DroppedAfter += Capture->PendingDrops;
+    }
+    Capture->PendingDrops = 0;
+
+    PlatformMutexUnlock(&Capture->WriteMutex);
+}
+
+// The GPU must be idle and every pending slot retired before shutting down
+static void FrameCaptureShutdown(frame_capture *Capture)
+{
+    WorkQueueCompleteAll(Capture->WorkQueue);
+
+    // Drops after the last captured frame still take up time in the stream
+    FrameCaptureStop(Capture);
+
+    for(u32 SlotIndex = 0; SlotIndex < CAPTURE_RING_SIZE; ++SlotIndex)
+    {
+        Assert(Capture->Slots[SlotIndex].State == CaptureSlot_Free);
+        EncodeBufferFree(&Capture->Slots[SlotIndex].Output);
+        EncodeBufferFree(&Capture->Slots[SlotIndex].Scratch);
+    }
+
+    EncodeBufferFree(&Capture->LastFrame);
+
+    if(Capture->Stream)
+    {
+        fclose(Capture->Stream);
+        Capture->Stream = NULL;
+    }
+
+    PlatformMutexDestroy(&Capture->WriteMutex);
+    PlatformMutexDestroy(&Capture->Mutex);
+}
+
+#endif
@@ -0,0 +1,673 @@
+#ifndef IMAGE_ENCODE_H
+#define IMAGE_ENCODE_H
+
+// Image encoders for captured frames: raw RGBA, Y4M (4:2:0) and PNG.
+//
+// The PNG encoder trades compression ratio for speed: per row filter selection with SSE2
+// Sub/Up filters and scoring, then a single fixed Huffman deflate block fed by a greedy
+// LZ77 matcher with a one entry hash table (no chains, no lazy matching). Stored blocks
+// are available when even that is too slow.
+//
+// Input pixels are 8-bit RGBA rows, Pitch bytes apart. ImageEncodeInit must be called once
+// before encoding from any thread.
+
+#include "base.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMAGE_ENCODE_SSE2 1
+#else
+#define IMAGE_ENCODE_SSE2 0
+#endif
+
+typedef struct encode_buffer
+{
+    u8 *Data;
+    size_t Size;
+    size_t Capacity;
+} encode_buffer;
+
+// Makes room for Bytes more bytes and returns the write position, Size is not advanced
+static u8 *EncodeBufferReserve(encode_buffer *Buffer, size_t Bytes)
+{
+    if(Buffer->Size + Bytes > Buffer->Capacity)
+    {
+        size_t Capacity = Maximum(Buffer->Capacity * 2, Buffer->Size + Bytes);
+        Buffer->Data = (u8 *)realloc(Buffer->Data, Capacity);
+        Assert(Buffer->Data);
+        Buffer->Capacity = Capacity;
+    }
+    return Buffer->Data + Buffer->Size;
+}
+
+static void EncodeBufferAppend(encode_buffer *Buffer, const void *Data, size_t Bytes)
+{
+    memcpy(EncodeBufferReserve(Buffer, Bytes), Data, Bytes);
+    Buffer->Size += Bytes;
+}
+
+static void EncodeBufferFree(encode_buffer *Buffer)
+{
+    free(Buffer->Data);
+    Buffer->Data     = NULL;
+    Buffer->Size     = 0;
+    Buffer->Capacity = 0;
+}
+
+//------------------------------------------------------------------------
+// Tables
+
+static u32 Crc32Table[4][256];
+
+static u16 DeflateLiteralCode[288]; // Fixed Huffman codes, bit reversed for LSB first output
+static u8  DeflateLiteralBits[288];
+static u8  DeflateDistanceCodeRev[30];
+static u16 DeflateLengthSymbol[259]; // Length 3..258 -> symbol 257..285
+static u8  DeflateDistanceSymbol[512]; // See DeflateDistanceToSymbol
+
+static const u16 DeflateLengthBase[29]  = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+static const u8  DeflateLengthExtra[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+static const u16 DeflateDistanceBase[30]  = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+static const u8  DeflateDistanceExtra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+
+static u32 ReverseBits(u32 Value, u32 Count)
+{
+    u32 Result = 0;
+    for(u32 Bit = 0; Bit < Count; ++Bit)
+    {
+        Result = (Result << 1) | ((Value >> Bit) & 1);
+    }
+    return Result;
+}
+
+static void ImageEncodeInit(void)
+{
+    // CRC-32 (PNG) tables for slicing by 4
+    for(u32 Byte = 0; Byte < 256; ++Byte)
+    {
+        u32 Crc = Byte;
+        for(u32 Bit = 0; Bit < 8; ++Bit)
+        {
+            Crc = (Crc & 1) ? (0xEDB88320 ^ (Crc >> 1)) : (Crc >> 1);
+        }
+        Crc32Table[0][Byte] = Crc;
+    }
+    for(u32 Byte = 0; Byte < 256; ++Byte)
+    {
+        for(u32 Slice = 1; Slice < 4; ++Slice)
+        {
+            u32 Previous = Crc32Table[Slice - 1][Byte];
+            Crc32Table[Slice][Byte] = (Previous >> 8) ^ Crc32Table[0][Previous & 0xFF];
+        }
+    }
+
+    // Fixed literal/length codes (RFC 1951, 3.2.6)
+    for(u32 Symbol = 0; Symbol < 288; ++Symbol)
+    {
+        u32 Code, Bits;
+        if(Symbol < 144)      { Code = 0x30  + Symbol;         Bits = 8; }
+        else if(Symbol < 256) { Code = 0x190 + (Symbol - 144); Bits = 9; }
+        else if(Symbol < 280) { Code = Symbol - 256;           Bits = 7; }
+        else                  { Code = 0xC0  + (Symbol - 280); Bits = 8; }
+        DeflateLiteralCode[Symbol] = (u16)ReverseBits(Code, Bits);
+        DeflateLiteralBits[Symbol] = (u8)Bits;
+    }
+    for(u32 Symbol = 0; Symbol < 30; ++Symbol)
+    {
+        DeflateDistanceCodeRev[Symbol] = (u8)ReverseBits(Symbol, 5);
+    }
+
+    for(u32 Symbol = 0; Symbol < 29; ++Symbol)
+    {
+        u32 End = (Symbol == 28) ? 259 : DeflateLengthBase[Symbol + 1];
+        for(u32 Length = DeflateLengthBase[Symbol]; Length < End; ++Length)
+        {
+            DeflateLengthSymbol[Length] = (u16)(257 + Symbol);
+        }
+    }
+
+    // Distances up to 256 index directly, larger ones by (Distance - 1) >> 7
+    for(u32 Symbol = 0; Symbol < 30; ++Symbol)
+    {
+        u32 Begin = DeflateDistanceBase[Symbol];
+        u32 End   = Begin + (1u << DeflateDistanceExtra[Symbol]);
+        for(u32 Distance = Begin; Distance < End; ++Distance)
+        {
+            if(Distance <= 256)
+            {
+                DeflateDistanceSymbol[Distance - 1] = (u8)Symbol;
+            }
+            else
+            {
+                DeflateDistanceSymbol[256 + ((Distance - 1) >> 7)] = (u8)Symbol;
+            }
+        }
+    }
+}
+
+static u32 DeflateDistanceToSymbol(u32 Distance)
+{
+    return (Distance <= 256) ? DeflateDistanceSymbol[Distance - 1] : DeflateDistanceSymbol[256 + ((Distance - 1) >> 7)];
+}
+
+//------------------------------------------------------------------------
+// Checksums
+
+static u32 Crc32Update(u32 Crc, const u8 *Data, size_t Size)
+{
+    Crc = ~Crc;
+    while(Size >= 4)
+    {
+        Crc ^= (u32)Data[0] | ((u32)Data[1] << 8) | ((u32)Data[2] << 16) | ((u32)Data[3] << 24);
+        Crc = Crc32Table[3][Crc & 0xFF] ^ Crc32Table[2][(Crc >> 8) & 0xFF] ^
+              Crc32Table[1][(Crc >> 16) & 0xFF] ^ Crc32Table[0][Crc >> 24];
+        Data += 4;
+        Size -= 4;
+    }
+    while(Size--)
+    {
+        Crc = Crc32Table[0][(Crc ^ *Data++) & 0xFF] ^ (Crc >> 8);
+    }
+    return ~Crc;
+}
+
+static u32 Adler32(const u8 *Data, size_t Size)
+{
+    // 5552 is the largest block that cannot overflow the 32-bit sums before the modulo
+    u32 A = 1;
+    u32 B = 0;
+    while(Size > 0)
+    {
+        size_t Block = Minimum(Size, (size_t)5552);
+        Size -= Block;
+        while(Block--)
+        {
+            A += *Data++;
+            B += A;
+        }
+        A %= 65521;
+        B %= 65521;
+    }
+    return (B << 16) | A;
+}
+
+//------------------------------------------------------------------------
+// Deflate
+
+typedef struct bit_writer
+{
+    u8 *Out;
+    u64 Bits;
+    u32 Count;
+} bit_writer;
+
+// Writes up to 16 bits, Out must have room for the whole stream
+static void BitWriterPut(bit_writer *Writer, u32 Value, u32 Count)
+{
+    Writer->Bits  |= (u64)Value << Writer->Count;
+    Writer->Count += Count;
+    if(Writer->Count >= 32)
+    {
+        u32 Word = (u32)Writer->Bits;
+        Writer->Out[0] = (u8)(Word >> 0);
+        Writer->Out[1] = (u8)(Word >> 8);
+        Writer->Out[2] = (u8)(Word >> 16);
+        Writer->Out[3] = (u8)(Word >> 24);
+        Writer->Out   += 4;
+        Writer->Bits >>= 32;
+        Writer->Count -= 32;
+    }
+}
+
+static void BitWriterFlush(bit_writer *Writer)
+{
+    while(Writer->Count > 0)
+    {
+        *Writer->Out++ = (u8)Writer->Bits;
+        Writer->Bits >>= 8;
+        Writer->Count = (Writer->Count > 8) ? Writer->Count - 8 : 0;
+    }
+    Writer->Bits = 0;
+}
+
+static u32 Load32(const u8 *Data)
+{
+    u32 Result;
+    memcpy(&Result, Data, sizeof(Result));
+    return Result;
+}
+
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_WINDOW_SIZE 32768
+#define DEFLATE_MIN_MATCH 4
+#define DEFLATE_MAX_MATCH 258
+
+// HashTable must hold 1 << DEFLATE_HASH_BITS entries
+static u8 *DeflateFixed(const u8 *Data, size_t Size, u8 *Out, u32 *HashTable)
+{
+    memset(HashTable, 0, sizeof(u32) << DEFLATE_HASH_BITS);
+
+    bit_writer Writer = { Out, 0, 0 };
+    BitWriterPut(&Writer, 1, 1); // BFINAL
+    BitWriterPut(&Writer, 1, 2); // BTYPE = fixed Huffman
+
+    size_t Position = 0;
+    while(Position + DEFLATE_MIN_MATCH <= Size)
+    {
+        u32 Sequence = Load32(Data + Position);
+        u32 Hash     = (Sequence * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+
+        // Table stores position + 1 so that zero means empty
+        size_t Candidate = HashTable[Hash];
+        HashTable[Hash] = (u32)(Position + 1);
+
+        if(Candidate && Position - (Candidate - 1) <= DEFLATE_WINDOW_SIZE && Load32(Data + Candidate - 1) == Sequence)
+        {
+            const u8 *Match = Data + Candidate - 1;
+            u32 MaxLength = (u32)Minimum(Size - Position, (size_t)DEFLATE_MAX_MATCH);
+            u32 Length = DEFLATE_MIN_MATCH;
+            while(Length < MaxLength && Match[Length] == Data[Position + Length])
+            {
+                ++Length;
+            }
+            u32 Distance = (u32)(Position - (Candidate - 1));
+
+            u32 LengthSymbol = DeflateLengthSymbol[Length];
+            u32 LengthIndex  = LengthSymbol - 257;
+            BitWriterPut(&Writer, DeflateLiteralCode[LengthSymbol], DeflateLiteralBits[LengthSymbol]);
+            if(DeflateLengthExtra[LengthIndex])
+            {
+                BitWriterPut(&Writer, Length - DeflateLengthBase[LengthIndex], DeflateLengthExtra[LengthIndex]);
+            }
+
+            u32 DistanceSymbol = DeflateDistanceToSymbol(Distance);
+            BitWriterPut(&Writer, DeflateDistanceCodeRev[DistanceSymbol], 5);
+            if(DeflateDistanceExtra[DistanceSymbol])
+            {
+                BitWriterPut(&Writer, Distance - DeflateDistanceBase[DistanceSymbol], DeflateDistanceExtra[DistanceSymbol]);
+            }
+
+            Position += Length;
+        }
+        else
+        {
+            u8 Literal = Data[Position++];
+            BitWriterPut(&Writer, DeflateLiteralCode[Literal], DeflateLiteralBits[Literal]);
+        }
+    }
+    while(Position < Size)
+    {
+        u8 Literal = Data[Position++];
+        BitWriterPut(&Writer, DeflateLiteralCode[Literal], DeflateLiteralBits[Literal]);
+    }
+
+    BitWriterPut(&Writer, DeflateLiteralCode[256], DeflateLiteralBits[256]);
+    BitWriterFlush(&Writer);
+    return Writer.Out;
+}
+
+static u8 *DeflateStored(const u8 *Data, size_t Size, u8 *Out)
+{
+    do
+    {
+        u32 Block = (u32)Minimum(Size, (size_t)65535);
+        Size -= Block;
+
+        *Out++ = (Size == 0) ? 1 : 0; // BFINAL, BTYPE = stored
+        *Out++ = (u8)(Block);
+        *Out++ = (u8)(Block >> 8);
+        *Out++ = (u8)(~Block);
+        *Out++ = (u8)(~Block >> 8);
+        memcpy(Out, Data, Block);
+        Out  += Block;
+        Data += Block;
+    } while(Size > 0);
+    return Out;
+}
+
+// Appends a zlib stream. Worst case output size is reserved up front.
+static void ZlibCompress(encode_buffer *Output, const u8 *Data, size_t Size, b32 Stored, u32 *HashTable)
+{
+    // Fixed Huffman codes are at most 9 bits per input byte, stored blocks add 5 bytes per 64K
+    size_t Bound = Size + Size / 8 + (Size / 65535 + 1) * 5 + 64;
+    u8 *Start = EncodeBufferReserve(Output, Bound);
+    u8 *Out = Start;
+
+    *Out++ = 0x78; // Deflate, 32K window
+    *Out++ = 0x01; // Fastest compression, check bits
+    Out = Stored ? DeflateStored(Data, Size, Out) : DeflateFixed(Data, Size, Out, HashTable);
+
+    u32 Adler = Adler32(Data, Size);
+    *Out++ = (u8)(Adler >> 24);
+    *Out++ = (u8)(Adler >> 16);
+    *Out++ = (u8)(Adler >> 8);
+    *Out++ = (u8)(Adler);
+
+    Output->Size += (size_t)(Out - Start);
+    Assert(Output->Size <= Output->Capacity);
+}
+
+//------------------------------------------------------------------------
+// PNG
+
+enum
+{
+    PngFilter_None  = 0,
+    PngFilter_Sub   = 1,
+    PngFilter_Up    = 2,
+    PngFilter_Paeth = 4,
+};
+
+// Sum of absolute values of the filtered bytes taken as signed, the usual filter heuristic
+static u32 PngFilterScore(const u8 *Row, u32 Size)
+{
+    u32 Score = 0;
+    u32 Index = 0;
+#if IMAGE_ENCODE_SSE2
+    __m128i Zero = _mm_setzero_si128();
+    __m128i Sum  = _mm_setzero_si128();
+    for(; Index + 16 <= Size; Index += 16)
+    {
+        __m128i Bytes = _mm_loadu_si128((const __m128i *)(Row + Index));
+        __m128i Abs   = _mm_min_epu8(Bytes, _mm_sub_epi8(Zero, Bytes));
+        Sum = _mm_add_epi64(Sum, _mm_sad_epu8(Abs, Zero));
+    }
+    Score = (u32)_mm_cvtsi128_si32(Sum) + (u32)_mm_cvtsi128_si32(_mm_srli_si128(Sum, 8));
+#endif
+    for(; Index < Size; ++Index)
+    {
+        u8 Byte = Row[Index];
+        Score += (Byte < 128) ? Byte : 256u - Byte;
+    }
+    return Score;
+}
+
+static void PngFilterSub(u8 *Out, const u8 *Row, u32 Size, u32 Bpp)
+{
+    memcpy(Out, Row, Bpp);
+    u32 Index = Bpp;
+#if IMAGE_ENCODE_SSE2
+    for(; Index + 16 <= Size; Index += 16)
+    {
+        __m128i Current = _mm_loadu_si128((const __m128i *)(Row + Index));
+        __m128i Left    = _mm_loadu_si128((const __m128i *)(Row + Index - Bpp));
+        _mm_storeu_si128((__m128i *)(Out + Index), _mm_sub_epi8(Current, Left));
+    }
+#endif
+    for(; Index < Size; ++Index)
+    {
+        Out[Index] = (u8)(Row[Index] - Row[Index - Bpp]);
+    }
+}
+
+static void PngFilterUp(u8 *Out, const u8 *Row, const u8 *Prior, u32 Size)
+{
+    u32 Index = 0;
+#if IMAGE_ENCODE_SSE2
+    for(; Index + 16 <= Size; Index += 16)
+    {
+        __m128i Current = _mm_loadu_si128((const __m128i *)(Row + Index));
+        __m128i Above   = _mm_loadu_si128((const __m128i *)(Prior + Index));
+        _mm_storeu_si128((__m128i *)(Out + Index), _mm_sub_epi8(Current, Above));
+    }
+#endif
+    for(; Index < Size; ++Index)
+    {
+        Out[Index] = (u8)(Row[Index] - Prior[Index]);
+    }
+}
+
+#if IMAGE_ENCODE_SSE2
+static __m128i PngSelect(__m128i Mask, __m128i IfSet, __m128i IfClear)
+{
+    return _mm_or_si128(_mm_and_si128(Mask, IfSet), _mm_andnot_si128(Mask, IfClear));
+}
+
+static __m128i PngAbs16(__m128i Value)
+{
+    return _mm_max_epi16(Value, _mm_sub_epi16(_mm_setzero_si128(), Value));
+}
+
+// Paeth predictor for 8 pixels bytes widened to 16 bits
+static __m128i PngPaethPredict16(__m128i A, __m128i B, __m128i C)
+{
+    // P - A = B - C, P - B = A - C, P - C = A + B - 2C
+    __m128i PA = PngAbs16(_mm_sub_epi16(B, C));
+    __m128i PB = PngAbs16(_mm_sub_epi16(A, C));
+    __m128i PC = PngAbs16(_mm_sub_epi16(_mm_add_epi16(A, B), _mm_add_epi16(C, C)));
+
+    __m128i NotA = _mm_or_si128(_mm_cmpgt_epi16(PA, PB), _mm_cmpgt_epi16(PA, PC));
+    __m128i NotB = _mm_cmpgt_epi16(PB, PC);
+    return PngSelect(NotA, PngSelect(NotB, C, B), A);
+}
+#endif
+
+// Encoding only reads unfiltered bytes, so unlike decoding there is no dependency between
+// neighbouring predictions and the filter vectorizes fully
+static void PngFilterPaeth(u8 *Out, const u8 *Row, const u8 *Prior, u32 Size, u32 Bpp)
+{
+    u32 Index = 0;
+    for(; Index < Bpp; ++Index)
+    {
+        // Left and upper left are zero, the predictor is always the byte above
+        Out[Index] = (u8)(Row[Index] - Prior[Index]);
+    }
+#if IMAGE_ENCODE_SSE2
+    __m128i Zero = _mm_setzero_si128();
+    for(; Index + 16 <= Size; Index += 16)
+    {
+        __m128i X = _mm_loadu_si128((const __m128i *)(Row + Index));
+        __m128i A = _mm_loadu_si128((const __m128i *)(Row + Index - Bpp));
+        __m128i B = _mm_loadu_si128((const __m128i *)(Prior + Index));
+        __m128i C = _mm_loadu_si128((const __m128i *)(Prior + Index - Bpp));
+
+        __m128i Low  = PngPaethPredict16(_mm_unpacklo_epi8(A, Zero), _mm_unpacklo_epi8(B, Zero), _mm_unpacklo_epi8(C, Zero));
+        __m128i High = PngPaethPredict16(_mm_unpackhi_epi8(A, Zero), _mm_unpackhi_epi8(B, Zero), _mm_unpackhi_epi8(C, Zero));
+        __m128i Predictor = _mm_packus_epi16(Low, High);
+
+        _mm_storeu_si128((__m128i *)(Out + Index), _mm_sub_epi8(X, Predictor));
+    }
+#endif
+    for(; Index < Size; ++Index)
+    {
+        s32 A = (Index >= Bpp) ? Row[Index - Bpp]   : 0;
+        s32 B = Prior[Index];
+        s32 C = (Index >= Bpp) ? Prior[Index - Bpp] : 0;
+        s32 P  = A + B - C;
+        s32 PA = P > A ? P - A : A - P;
+        s32 PB = P > B ? P - B : B - P;
+        s32 PC = P > C ? P - C : C - P;
+        s32 Predictor = (PA <= PB && PA <= PC) ? A : (PB <= PC) ? B : C;
+        Out[Index] = (u8)(Row[Index] - Predictor);
+    }
+}
+
+static void PngWriteChunk(encode_buffer *Output, const char *Type, const u8 *Data, u32 Size)
+{
+    u8 Header[8] =
+    {
+        (u8)(Size >> 24), (u8)(Size >> 16), (u8)(Size >> 8), (u8)Size,
+        (u8)Type[0], (u8)Type[1], (u8)Type[2], (u8)Type[3]
+    };
+    EncodeBufferAppend(Output, Header, sizeof(Header));
+    EncodeBufferAppend(Output, Data, Size);
+
+    u32 Crc = Crc32Update(0, Header + 4, 4);
+    Crc = Crc32Update(Crc, Data, Size);
+    u8 Footer[4] = { (u8)(Crc >> 24), (u8)(Crc >> 16), (u8)(Crc >> 8), (u8)Crc };
+    EncodeBufferAppend(Output, Footer, sizeof(Footer));
+}
+
+// Encodes RGBA pixels as an 8-bit RGB PNG, alpha is dropped.
+// Scratch holds the filtered image and match table between calls, so steady state encoding does not allocate.
+static void EncodePNG(encode_buffer *Output, encode_buffer *Scratch, const u8 *Pixels, u32 Width, u32 Height, u32 Pitch, b32 Stored)
+{
+    u32 Bpp     = 3;
+    u32 RowSize = Width * Bpp;
+
+    size_t FilteredSize  = (size_t)(RowSize + 1) * Height;
+    size_t RowsSize      = (size_t)RowSize * 6; // Previous, current and 4 candidate rows
+    size_t HashTableSize = sizeof(u32) << DEFLATE_HASH_BITS;
+
+    Scratch->Size = 0;
+    u8 *Filtered = EncodeBufferReserve(Scratch, FilteredSize + RowsSize + HashTableSize + 16);
+    u8 *Prior      = Filtered + FilteredSize;
+    u8 *Current    = Prior + RowSize;
+    u8 *Candidates = Current + RowSize;
+    u32 *HashTable = (u32 *)(((uintptr_t)(Candidates + RowSize * 4) + 15) & ~(uintptr_t)15);
+
+    memset(Prior, 0, RowSize);
+
+    u8 *Out = Filtered;
+    for(u32 Y = 0; Y < Height; ++Y)
+    {
+        const u8 *Source = Pixels + (size_t)Y * Pitch;
+        for(u32 X = 0; X < Width; ++X)
+        {
+            Current[X*3 + 0] = Source[X*4 + 0];
+            Current[X*3 + 1] = Source[X*4 + 1];
+            Current[X*3 + 2] = Source[X*4 + 2];
+        }
+
+        u8 *None  = Current;
+        u8 *Sub   = Candidates;
+        u8 *Up    = Candidates + RowSize;
+        u8 *Paeth = Candidates + RowSize * 2;
+        PngFilterSub(Sub, Current, RowSize, Bpp);
+        PngFilterUp(Up, Current, Prior, RowSize);
+        PngFilterPaeth(Paeth, Current, Prior, RowSize, Bpp);
+
+        u8 *Rows[]  = { None, Sub, Up, Paeth };
+        u8 Types[]  = { PngFilter_None, PngFilter_Sub, PngFilter_Up, PngFilter_Paeth };
+        u32 Best = 0;
+        u32 BestScore = PngFilterScore(Rows[0], RowSize);
+        for(u32 Filter = 1; Filter < ArrayCount(Rows); ++Filter)
+        {
+            u32 Score = PngFilterScore(Rows[Filter], RowSize);
+            if(Score < BestScore)
+            {
+                Best = Filter;
+                BestScore = Score;
+            }
+        }
+
+        *Out++ = Types[Best];
+        memcpy(Out, Rows[Best], RowSize);
+        Out += RowSize;
+
+        u8 *Swap = Prior;
+        Prior    = Current;
+        Current  = Swap;
+    }
+
+    static const u8 Signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    EncodeBufferAppend(Output, Signature, sizeof(Signature));
+
+    u8 Header[13] =
+    {
+        (u8)(Width >> 24),  (u8)(Width >> 16),  (u8)(Width >> 8),  (u8)Width,
+        (u8)(Height >> 24), (u8)(Height >> 16), (u8)(Height >> 8), (u8)Height,
+        8, // Bit depth
+        2, // Color type RGB
+        0, // Deflate
+        0, // Adaptive filtering
+        0, // No interlace
+    };
+    PngWriteChunk(Output, "IHDR", Header, sizeof(Header));
+
+    // Compress straight after the chunk header, the length is patched once known
+    size_t ChunkStart = Output->Size;
+    u8 ChunkHeader[8] = { 0, 0, 0, 0, 'I', 'D', 'A', 'T' };
+    EncodeBufferAppend(Output, ChunkHeader, sizeof(ChunkHeader));
+    ZlibCompress(Output, Filtered, FilteredSize, Stored, HashTable);
+
+    u8 *Chunk = Output->Data + ChunkStart;
+    u32 ChunkSize = (u32)(Output->Size - ChunkStart - 8);
+    Chunk[0] = (u8)(ChunkSize >> 24);
+    Chunk[1] = (u8)(ChunkSize >> 16);
+    Chunk[2] = (u8)(ChunkSize >> 8);
+    Chunk[3] = (u8)(ChunkSize);
+
+    u32 Crc = Crc32Update(0, Chunk + 4, ChunkSize + 4);
+    u8 Footer[4] = { (u8)(Crc >> 24), (u8)(Crc >> 16), (u8)(Crc >> 8), (u8)Crc };
+    EncodeBufferAppend(Output, Footer, sizeof(Footer));
+
+    PngWriteChunk(Output, "IEND", NULL, 0);
+}
+
+//------------------------------------------------------------------------
+// Raw and Y4M
+
+static void EncodeRaw(encode_buffer *Output, const u8 *Pixels, u32 Width, u32 Height, u32 Pitch)
+{
+    u32 RowSize = Width * 4;
+    u8 *Out = EncodeBufferReserve(Output, (size_t)RowSize * Height);
+    for(u32 Y = 0; Y < Height; ++Y)
+    {
+        memcpy(Out + (size_t)Y * RowSize, Pixels + (size_t)Y * Pitch, RowSize);
+    }
+    Output->Size += (size_t)RowSize * Height;
+}
+
+// Stream header, full range BT.601 4:2:0 with JPEG chroma siting
+static void EncodeY4MHeader(encode_buffer *Output, u32 Width, u32 Height, u32 FramesPerSecond)
+{
+    char Header[128];
+    int Length = snprintf(Header, sizeof(Header), "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n", Width, Height, FramesPerSecond);
+    Assert(Length > 0 && Length < (int)sizeof(Header));
+    EncodeBufferAppend(Output, Header, (size_t)Length);
+}
+
+static void EncodeY4MFrame(encode_buffer *Output, const u8 *Pixels, u32 Width, u32 Height, u32 Pitch)
+{
+    Assert((Width % 2) == 0 && (Height % 2) == 0);
+
+    static const char FrameHeader[] = "FRAME\n";
+    EncodeBufferAppend(Output, FrameHeader, sizeof(FrameHeader) - 1);
+
+    size_t LumaSize   = (size_t)Width * Height;
+    size_t ChromaSize = LumaSize / 4;
+    u8 *PlaneY = EncodeBufferReserve(Output, LumaSize + ChromaSize * 2);
+    u8 *PlaneU = PlaneY + LumaSize;
+    u8 *PlaneV = PlaneU + ChromaSize;
+
+    // 16.16 fixed point JFIF coefficients. Chroma is computed from the 2x2 RGB average.
+    for(u32 Y = 0; Y < Height; Y += 2)
+    {
+        const u8 *Row0 = Pixels + (size_t)Y * Pitch;
+        const u8 *Row1 = Row0 + Pitch;
+        u8 *OutY0 = PlaneY + (size_t)Y * Width;
+        u8 *OutY1 = OutY0 + Width;
+        u8 *OutU  = PlaneU + (size_t)(Y / 2) * (Width / 2);
+        u8 *OutV  = PlaneV + (size_t)(Y / 2) * (Width / 2);
+
+        for(u32 X = 0; X < Width; X += 2)
+        {
+            const u8 *P[4] = { Row0 + X*4, Row0 + X*4 + 4, Row1 + X*4, Row1 + X*4 + 4 };
+            u8 *Luma[4]    = { OutY0 + X, OutY0 + X + 1, OutY1 + X, OutY1 + X + 1 };
+
+            s32 SumR = 0, SumG = 0, SumB = 0;
+            for(u32 Index = 0; Index < 4; ++Index)
+            {
+                s32 R = P[Index][0], G = P[Index][1], B = P[Index][2];
+                *Luma[Index] = (u8)((19595*R + 38470*G + 7471*B + 32768) >> 16);
+                SumR += R;
+                SumG += G;
+                SumB += B;
+            }
+
+            // Sums are 4x the average, fold the divide into the shift. Pure blue/red round up to 256.
+            s32 U = (-11059*SumR - 21709*SumG + 32768*SumB + (128 << 18) + (1 << 17)) >> 18;
+            s32 V = ( 32768*SumR - 27439*SumG -  5329*SumB + (128 << 18) + (1 << 17)) >> 18;
+            *OutU++ = (u8)Minimum(U, 255);
+            *OutV++ = (u8)Minimum(V, 255);
+        }
+    }
+
+    Output->Size += LumaSize + ChromaSize * 2;
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef LINUX_BENCH_COMMON_H
+#define LINUX_BENCH_COMMON_H
+
+// Shared by the linux_bench_*.c drivers
+//
+// Each driver is a single file that includes the module it exercises and this header, and
+// builds with the gcc line at its top. Drivers print their timings and exit non-zero on the
+// first failed check.
+
+#include "base.h"
+#include <stdio.h>
+#include <time.h>
+
+static f64 GetMilliseconds(void)
+{
+    struct timespec Time;
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+    return (f64)Time.tv_sec * 1000.0 + (f64)Time.tv_nsec / 1000000.0;
+}
+
+// xorshift64 with a fixed seed, every run sees the same data
+static u64 RandomState = 88172645463325252ull;
+static u32 Random(void)
+{
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 7;
+    RandomState ^= RandomState << 17;
+    return (u32)RandomState;
+}
+
+#endif
@@ -0,0 +1,150 @@
+// Benchmarks and checks the draw queue radix sort on Linux
+//
+// Build and run:
+//   gcc -O2 -o linux_bench_draw_queue linux_bench_draw_queue.c -lpthread
+//   ./linux_bench_draw_queue
+//
+// Checks that random keys of both layouts decode back to the fields they were packed from.
+// Sorts 100k to 1M random keys with qsort, the serial radix sort and the parallel radix sort.
+// Both radix paths are checked against qsort for order, and for stability (equal keys keep
+// their push order). At least 3 workers are started even on small machines so the parallel
+// path is always exercised.
+
+#include "draw_queue.h"
+#include "linux_bench_common.h"
+
+static int CompareKeys(const void *A, const void *B)
+{
+    u64 KeyA = ((const draw_item *)A)->Key;
+    u64 KeyB = ((const draw_item *)B)->Key;
+    return (KeyA < KeyB) ? -1 : (KeyA > KeyB);
+}
+
+// Keys must match the reference order and equal keys must keep ascending draw indices
+static b32 CheckSorted(draw_item *Items, draw_item *Reference, u32 Count, const char *Name)
+{
+    for(u32 Index = 0; Index < Count; ++Index)
+    {
+        if(Items[Index].Key != Reference[Index].Key)
+        {
+            printf("%s: key mismatch at %u\n", Name, Index);
+            return 0;
+        }
+        if(Index > 0 && Items[Index].Key == Items[Index - 1].Key && Items[Index].DrawIndex < Items[Index - 1].DrawIndex)
+        {
+            printf("%s: not stable at %u\n", Name, Index);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void CountDraw(void *Context, u32 DrawIndex) { ++*(u32 *)Context; }
+static void IgnoreState(void *Context, u32 Value)   { }
+
+int main(void)
+{
+    u32 ProcessorCount = PlatformGetProcessorCount();
+    u32 ThreadCount = Maximum(ProcessorCount - 1, 3);
+    ThreadCount = Minimum(ThreadCount, WORK_QUEUE_MAX_THREADS);
+
+    work_queue WorkQueue;
+    WorkQueueInit(&WorkQueue, ThreadCount);
+    printf("%u processors, %u workers\n", ProcessorCount, ThreadCount);
+
+    // Every field reads back as packed, in both layouts
+    for(u32 Index = 0; Index < 100000; ++Index)
+    {
+        u32 Layer    = Random() % (1u << DRAW_KEY_LAYER_BITS);
+        u32 Pass     = Random() % (1u << DRAW_KEY_PASS_BITS);
+        u32 Pipeline = Random() % (1u << DRAW_KEY_PIPELINE_BITS);
+        u32 Material = Random() % (1u << DRAW_KEY_MATERIAL_BITS);
+        u32 Depth    = Random() % (1u << DRAW_KEY_DEPTH_BITS);
+        u64 Key = DrawKeyPack(Layer, Pass, Pipeline, Material, Depth);
+        if(DrawKeyField(Key, LAYER) != Layer || DrawKeyField(Key, PASS) != Pass || DrawKeyField(Key, PIPELINE) != Pipeline ||
+           DrawKeyField(Key, MATERIAL) != Material || DrawKeyDepth(Key) != Depth)
+        {
+            printf("key %016llx (pass %u) does not decode to its fields\n", (unsigned long long)Key, Pass);
+            return 1;
+        }
+    }
+
+    u32 Counts[] = { 100000, 250000, 500000, 1000000 };
+    const u32 Repeats = 5;
+
+    for(u32 CountIndex = 0; CountIndex < ArrayCount(Counts); ++CountIndex)
+    {
+        u32 Count = Counts[CountIndex];
+
+        draw_queue Queue;
+        DrawQueueInit(&Queue, Count);
+        draw_item *Unsorted  = (draw_item *)malloc(Count * sizeof(draw_item));
+        draw_item *Reference = (draw_item *)malloc(Count * sizeof(draw_item));
+        Assert(Unsorted && Reference);
+
+        f64 QsortMs = 0.0, SerialMs = 0.0, ParallelMs = 0.0;
+        for(u32 Repeat = 0; Repeat < Repeats; ++Repeat)
+        {
+            // Few layers, passes and pipelines, many materials and depths, like a real frame
+            DrawQueueReset(&Queue);
+            for(u32 Index = 0; Index < Count; ++Index)
+            {
+                u32 Pass = (Random() % 4 == 0) ? DrawPass_Translucent : DrawPass_Opaque;
+                u64 Key = DrawKeyPack(Random() % 2, Pass, Random() % 200, Random() % 5000, Random() & 0xFFFFFF);
+                DrawQueuePush(&Queue, Key, Index);
+            }
+            memcpy(Unsorted, Queue.Items, Count * sizeof(draw_item));
+            memcpy(Reference, Queue.Items, Count * sizeof(draw_item));
+
+            // qsort is not stable, only its key order is used as reference
+            f64 Start = GetMilliseconds();
+            qsort(Reference, Count, sizeof(draw_item), CompareKeys);
+            QsortMs += GetMilliseconds() - Start;
+
+            Start = GetMilliseconds();
+            DrawQueueSort(&Queue, NULL);
+            SerialMs += GetMilliseconds() - Start;
+            if(!CheckSorted(Queue.Items, Reference, Count, "serial")) return 1;
+
+            memcpy(Queue.Items, Unsorted, Count * sizeof(draw_item));
+            Start = GetMilliseconds();
+            DrawQueueSort(&Queue, &WorkQueue);
+            ParallelMs += GetMilliseconds() - Start;
+            if(!CheckSorted(Queue.Items, Reference, Count, "parallel")) return 1;
+        }
+
+        // Translucent draws of a layer must come out far to near
+        for(u32 Index = 1; Index < Count; ++Index)
+        {
+            u64 Previous = Queue.Items[Index - 1].Key;
+            u64 Current  = Queue.Items[Index].Key;
+            if(DrawKeyIsTranslucent(Previous) && DrawKeyIsTranslucent(Current) &&
+               DrawKeyField(Previous, LAYER) == DrawKeyField(Current, LAYER) &&
+               DrawKeyDepth(Previous) < DrawKeyDepth(Current))
+            {
+                printf("translucent draws out of depth order at %u\n", Index);
+                return 1;
+            }
+        }
+
+        u32 Draws = 0;
+        draw_submit_callbacks Callbacks = {0};
+        Callbacks.Context     = &Draws;
+        Callbacks.SetPipeline = IgnoreState;
+        Callbacks.SetMaterial = IgnoreState;
+        Callbacks.Draw        = CountDraw;
+        draw_submit_stats Stats = DrawQueueSubmit(&Queue, &Callbacks);
+        Assert(Draws == Count);
+
+        printf("%7u items: qsort %7.2f ms  radix %6.2f ms  radix mt %6.2f ms  (pipeline changes %u, material changes %u)\n",
+               Count, QsortMs / Repeats, SerialMs / Repeats, ParallelMs / Repeats, Stats.PipelineChanges, Stats.MaterialChanges);
+
+        free(Reference);
+        free(Unsorted);
+        DrawQueueFree(&Queue);
+    }
+
+    WorkQueueShutdown(&WorkQueue);
+    printf("ok\n");
+    return 0;
+}
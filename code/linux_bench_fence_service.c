@@ -0,0 +1,354 @@
+// Benchmarks and checks the fence completion service on Linux
+//
+// Build and run:
+//   gcc -O2 -o linux_bench_fence_service linux_bench_fence_service.c -lpthread
+//   ./linux_bench_fence_service
+//
+// Under ThreadSanitizer:
+//   gcc -O1 -g -fsanitize=thread -o linux_bench_fence_service_tsan linux_bench_fence_service.c -lpthread
+//   ./linux_bench_fence_service_tsan
+//
+// Checks the heap order (value, then registration order) and times push and pop, runs the
+// dispatcher over 4 software fences, checks FenceServiceWait against callbacks registered
+// for values that were already reached and against a callback that is still running, times
+// the Wait fast path and the signal to callback latency, and finally has two threads
+// register, signal and wait on their own fences at the same time.
+
+#include "fence_service.h"
+#include "linux_bench_common.h"
+
+// Callback bookkeeping per fence. Written on the waiter thread, read by the test threads
+// after FenceServiceWait, counters are atomic so reads racing later callbacks are fine.
+typedef struct fence_tally
+{
+    u64 Calls;
+    u64 LastValue;
+    b32 OutOfOrder;
+} fence_tally;
+
+static void TallyCallback(void *Data, u64 CompletedValue)
+{
+    fence_tally *Tally = (fence_tally *)Data;
+    if(CompletedValue < Tally->LastValue) Tally->OutOfOrder = 1;
+    Tally->LastValue = CompletedValue;
+    __atomic_fetch_add(&Tally->Calls, 1, __ATOMIC_RELEASE);
+}
+
+static u64 TallyCalls(fence_tally *Tally)
+{
+    return __atomic_load_n(&Tally->Calls, __ATOMIC_ACQUIRE);
+}
+
+static b32 CheckHeap(void)
+{
+    const u32 Count = 1 << 20;
+    fence_heap Heap;
+    FenceHeapInit(&Heap, Count);
+
+    // Values close to their push order with many ties, like real frame fences
+    f64 Start = GetMilliseconds();
+    for(u32 Index = 0; Index < Count; ++Index)
+    {
+        fence_callback_entry Entry = { .Value = Index + Random() % 64, .Sequence = Index };
+        FenceHeapPush(&Heap, Entry);
+    }
+    f64 PushMs = GetMilliseconds() - Start;
+
+    Start = GetMilliseconds();
+    fence_callback_entry Previous = {0};
+    for(u32 Index = 0; Index < Count; ++Index)
+    {
+        fence_callback_entry Entry = FenceHeapPop(&Heap);
+        if(Index > 0 && FenceEntryLess(&Entry, &Previous))
+        {
+            printf("heap: entry %u popped out of order\n", Index);
+            return 0;
+        }
+        Previous = Entry;
+    }
+    f64 PopMs = GetMilliseconds() - Start;
+
+    // Steady state of a renderer, a handful of frames outstanding
+    const u32 Steady = 10000000;
+    Start = GetMilliseconds();
+    for(u32 Index = 0; Index < 16; ++Index)
+    {
+        fence_callback_entry Entry = { .Value = Index, .Sequence = Index };
+        FenceHeapPush(&Heap, Entry);
+    }
+    for(u32 Index = 16; Index < Steady; ++Index)
+    {
+        FenceHeapPop(&Heap);
+        fence_callback_entry Entry = { .Value = Index, .Sequence = Index };
+        FenceHeapPush(&Heap, Entry);
+    }
+    f64 SteadyMs = GetMilliseconds() - Start;
+    FenceHeapFree(&Heap);
+
+    printf("heap, 1M entries              push %6.1f ns  pop %6.1f ns\n", PushMs * 1e6 / Count, PopMs * 1e6 / Count);
+    printf("heap, 16 outstanding          push + pop %6.1f ns\n", SteadyMs * 1e6 / Steady);
+    return 1;
+}
+
+static b32 CheckDispatch(void)
+{
+    fence_service Service;
+    FenceServiceInit(&Service, 1 << 16);
+
+    fence_tally Tallies[4] = {0};
+    u32 Fences[4];
+    for(u32 FenceIndex = 0; FenceIndex < ArrayCount(Fences); ++FenceIndex)
+    {
+        Fences[FenceIndex] = FenceServiceAddFence(&Service);
+    }
+
+    const u64 Values = 200000;
+    f64 Start = GetMilliseconds();
+    for(u64 Value = 1; Value <= Values; ++Value)
+    {
+        for(u32 FenceIndex = 0; FenceIndex < ArrayCount(Fences); ++FenceIndex)
+        {
+            FenceServiceRegister(&Service, Fences[FenceIndex], Value, TallyCallback, Tallies + FenceIndex);
+            FenceServiceRegister(&Service, Fences[FenceIndex], Value, TallyCallback, Tallies + FenceIndex);
+        }
+        for(u32 FenceIndex = 0; FenceIndex < ArrayCount(Fences); ++FenceIndex)
+        {
+            FenceServiceSignal(&Service, Fences[FenceIndex], Value);
+        }
+        if((Value & 1023) == 0)
+        {
+            FenceServiceWait(&Service, Fences[0], Value - 512);
+            if(TallyCalls(Tallies) < 2 * (Value - 512))
+            {
+                printf("dispatch: wait for %llu returned before its callbacks ran\n", (unsigned long long)(Value - 512));
+                return 0;
+            }
+        }
+    }
+    for(u32 FenceIndex = 0; FenceIndex < ArrayCount(Fences); ++FenceIndex)
+    {
+        FenceServiceWait(&Service, Fences[FenceIndex], Values);
+    }
+    f64 Ms = GetMilliseconds() - Start;
+
+    u64 Calls = 0;
+    for(u32 FenceIndex = 0; FenceIndex < ArrayCount(Fences); ++FenceIndex)
+    {
+        fence_tally *Tally = Tallies + FenceIndex;
+        if(TallyCalls(Tally) != 2 * Values || Tally->OutOfOrder || Tally->LastValue != Values)
+        {
+            printf("dispatch: fence %u ran %llu callbacks%s\n", FenceIndex, (unsigned long long)TallyCalls(Tally), Tally->OutOfOrder ? " out of order" : "");
+            return 0;
+        }
+        Calls += TallyCalls(Tally);
+    }
+    FenceServiceShutdown(&Service);
+
+    printf("dispatch, 4 fences            %6.1f ns per callback (register, signal and run)\n", Ms * 1e6 / Calls);
+    return 1;
+}
+
+typedef struct slow_callback
+{
+    b32 Started;
+    b32 Finished;
+} slow_callback;
+
+static void SlowCallback(void *Data, u64 CompletedValue)
+{
+    slow_callback *Slow = (slow_callback *)Data;
+    __atomic_store_n(&Slow->Started, 1, __ATOMIC_RELEASE);
+    struct timespec Delay = { 0, 20 * 1000000 };
+    nanosleep(&Delay, NULL);
+    __atomic_store_n(&Slow->Finished, 1, __ATOMIC_RELEASE);
+}
+
+static b32 CheckWait(void)
+{
+    fence_service Service;
+    FenceServiceInit(&Service, 64);
+    u32 Fence = FenceServiceAddFence(&Service);
+
+    // Registered after the value was reached and waited for: must still run before Wait returns
+    FenceServiceSignal(&Service, Fence, 10);
+    FenceServiceWait(&Service, Fence, 10);
+    fence_tally Tally = {0};
+    FenceServiceRegister(&Service, Fence, 5, TallyCallback, &Tally);
+    FenceServiceWait(&Service, Fence, 5);
+    if(TallyCalls(&Tally) != 1)
+    {
+        printf("wait: returned before a late registered callback ran\n");
+        return 0;
+    }
+
+    // Callback already popped and running: the fence and the heap say done, Wait must not
+    slow_callback Slow = {0};
+    FenceServiceRegister(&Service, Fence, 11, SlowCallback, &Slow);
+    FenceServiceSignal(&Service, Fence, 11);
+    while(!__atomic_load_n(&Slow.Started, __ATOMIC_ACQUIRE))
+    {
+        struct timespec Delay = { 0, 100000 };
+        nanosleep(&Delay, NULL);
+    }
+    FenceServiceWait(&Service, Fence, 11);
+    if(!__atomic_load_n(&Slow.Finished, __ATOMIC_ACQUIRE))
+    {
+        printf("wait: returned while a callback for its value was still running\n");
+        return 0;
+    }
+
+    // Values reached with nothing registered take the fast path, the waiter never sees them
+    const u64 Waits = 1000000;
+    FenceServiceSignal(&Service, Fence, 12 + Waits);
+    PlatformMutexLock(&Service.Mutex);
+    u64 DispatchCount = Service.DispatchCount;
+    PlatformMutexUnlock(&Service.Mutex);
+
+    f64 Start = GetMilliseconds();
+    for(u64 Value = 12; Value < 12 + Waits; ++Value)
+    {
+        FenceServiceWait(&Service, Fence, Value);
+    }
+    f64 Ms = GetMilliseconds() - Start;
+
+    PlatformMutexLock(&Service.Mutex);
+    b32 WaiterInvolved = (Service.DispatchCount != DispatchCount);
+    PlatformMutexUnlock(&Service.Mutex);
+    if(WaiterInvolved)
+    {
+        printf("wait: completed values still went through the waiter thread\n");
+        return 0;
+    }
+
+    FenceServiceShutdown(&Service);
+    printf("wait, value already reached   %6.1f ns\n", Ms * 1e6 / Waits);
+    return 1;
+}
+
+typedef struct latency_state
+{
+    f64 SignalMs;
+    f64 TotalMs;
+    u64 Calls;
+} latency_state;
+
+static void LatencyCallback(void *Data, u64 CompletedValue)
+{
+    latency_state *State = (latency_state *)Data;
+    State->TotalMs += GetMilliseconds() - State->SignalMs;
+    ++State->Calls;
+}
+
+static b32 CheckLatency(void)
+{
+    fence_service Service;
+    FenceServiceInit(&Service, 64);
+    u32 Fence = FenceServiceAddFence(&Service);
+
+    // State is handed over through the service mutex: written before Signal, read after Wait
+    latency_state State = {0};
+    const u64 Values = 20000;
+    for(u64 Value = 1; Value <= Values; ++Value)
+    {
+        FenceServiceRegister(&Service, Fence, Value, LatencyCallback, &State);
+        State.SignalMs = GetMilliseconds();
+        FenceServiceSignal(&Service, Fence, Value);
+        FenceServiceWait(&Service, Fence, Value);
+    }
+    FenceServiceShutdown(&Service);
+
+    if(State.Calls != Values)
+    {
+        printf("latency: %llu callbacks for %llu values\n", (unsigned long long)State.Calls, (unsigned long long)Values);
+        return 0;
+    }
+    printf("signal to callback            %6.1f us\n", State.TotalMs * 1000.0 / State.Calls);
+    return 1;
+}
+
+typedef struct stress_thread
+{
+    fence_service *Service;
+    u32 Fence;
+    fence_tally Tally;
+    b32 Failed;
+} stress_thread;
+
+// Each thread plays a GPU queue and its CPU side at once: register, signal, sometimes wait
+PLATFORM_THREAD_PROC(StressThreadProc)
+{
+    stress_thread *Thread = (stress_thread *)Parameter;
+    const u64 Values = 100000;
+    for(u64 Value = 1; Value <= Values; ++Value)
+    {
+        FenceServiceRegister(Thread->Service, Thread->Fence, Value, TallyCallback, &Thread->Tally);
+        FenceServiceRegister(Thread->Service, Thread->Fence, Value + 2, TallyCallback, &Thread->Tally);
+        FenceServiceSignal(Thread->Service, Thread->Fence, Value);
+        if((Value % 37) == 0)
+        {
+            // Up to Value - 1 that is one callback per value plus the ones registered 2 earlier
+            FenceServiceWait(Thread->Service, Thread->Fence, Value - 1);
+            if(TallyCalls(&Thread->Tally) < 2 * Value - 4)
+            {
+                Thread->Failed = 1;
+                break;
+            }
+        }
+    }
+    FenceServiceSignal(Thread->Service, Thread->Fence, Values + 2);
+    FenceServiceWait(Thread->Service, Thread->Fence, Values + 2);
+    if(TallyCalls(&Thread->Tally) != 2 * Values || Thread->Tally.OutOfOrder)
+    {
+        Thread->Failed = 1;
+    }
+    PLATFORM_THREAD_PROC_END();
+}
+
+static b32 CheckConcurrentSignals(void)
+{
+    fence_service Service;
+    FenceServiceInit(&Service, 1024);
+
+    stress_thread Threads[2] = {0};
+    platform_thread Handles[2];
+    for(u32 ThreadIndex = 0; ThreadIndex < ArrayCount(Threads); ++ThreadIndex)
+    {
+        Threads[ThreadIndex].Service = &Service;
+        Threads[ThreadIndex].Fence   = FenceServiceAddFence(&Service);
+    }
+
+    f64 Start = GetMilliseconds();
+    for(u32 ThreadIndex = 0; ThreadIndex < ArrayCount(Threads); ++ThreadIndex)
+    {
+        PlatformThreadCreate(Handles + ThreadIndex, StressThreadProc, Threads + ThreadIndex);
+    }
+    for(u32 ThreadIndex = 0; ThreadIndex < ArrayCount(Threads); ++ThreadIndex)
+    {
+        PlatformThreadJoin(Handles + ThreadIndex);
+    }
+    f64 Ms = GetMilliseconds() - Start;
+    FenceServiceShutdown(&Service);
+
+    for(u32 ThreadIndex = 0; ThreadIndex < ArrayCount(Threads); ++ThreadIndex)
+    {
+        if(Threads[ThreadIndex].Failed)
+        {
+            printf("concurrent: thread %u saw missing or out of order callbacks (%llu ran)\n",
+                   ThreadIndex, (unsigned long long)TallyCalls(&Threads[ThreadIndex].Tally));
+            return 0;
+        }
+    }
+    printf("2 signaling threads           %6.1f ms\n", Ms);
+    return 1;
+}
+
+int main(void)
+{
+    if(!CheckHeap()) return 1;
+    if(!CheckDispatch()) return 1;
+    if(!CheckWait()) return 1;
+    if(!CheckLatency()) return 1;
+    if(!CheckConcurrentSignals()) return 1;
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,626 @@
+// Benchmarks and checks the capture encoders on Linux
+//
+// Build and run:
+//   gcc -O2 -o linux_bench_image_encode linux_bench_image_encode.c -lpthread
+//   ./linux_bench_image_encode
+//
+// Times raw, Y4M and both PNG modes at 1280x720 and 3840x2160 from a padded (pitched) source.
+// Every PNG is decoded again by the small reference decoder below and compared with the source
+// pixels: chunk CRCs, the zlib Adler-32 and all five row filters are checked. The decoder only
+// understands stored and fixed Huffman blocks, which is all the encoder emits, so a dynamic
+// block is reported as a failure too.
+//
+// Then the capture ring is driven with a GPU that falls behind, forcing drops, and the raw and
+// Y4M streams are checked to hold one frame per frame rendered while capturing, in order, with
+// every dropped frame repeating the one before it, also across switching capture off and on.
+
+#include "frame_capture.h"
+#include "linux_bench_common.h"
+
+// Flat background, a gradient triangle and sparse noise: long matches, smooth areas and literals
+static void FillImage(u8 *Pixels, u32 Width, u32 Height, u32 Pitch, b32 Noisy)
+{
+    for(u32 Y = 0; Y < Height; ++Y)
+    {
+        u8 *Row = Pixels + (size_t)Y * Pitch;
+        for(u32 X = 0; X < Width; ++X)
+        {
+            u8 *P = Row + X*4;
+            b32 Inside = (X > Width/3 && X < 2*Width/3 && Y > Height/3 && Y < Height/3 + (X - Width/3));
+            P[0] = (u8)(Inside ? 255*X/Width : 13);
+            P[1] = (u8)(Inside ? 255*Y/Height : 13);
+            P[2] = (u8)(Inside ? 128 : 13);
+            P[3] = 255;
+            if(Noisy ? (Random() & 1) : ((X*7 + Y*13) % 97 == 0))
+            {
+                P[0] ^= (u8)Random();
+            }
+        }
+        // Garbage in the pitch padding must never reach the output
+        memset(Row + Width*4, 0xCD, Pitch - Width*4);
+    }
+}
+
+//------------------------------------------------------------------------
+// Reference PNG decoder
+
+typedef struct inflate_state
+{
+    const u8 *Input;
+    size_t InputSize;
+    size_t InputPosition;
+    u32 BitBuffer;
+    u32 BitCount;
+
+    u8 *Output;
+    size_t OutputSize;
+    size_t OutputPosition;
+    b32 Error;
+} inflate_state;
+
+typedef struct inflate_huffman
+{
+    u16 Counts[16];  // Codes per length
+    u16 Symbols[288]; // Symbols ordered by code
+} inflate_huffman;
+
+static u32 InflateBits(inflate_state *State, u32 Count)
+{
+    while(State->BitCount < Count)
+    {
+        if(State->InputPosition >= State->InputSize)
+        {
+            State->Error = 1;
+            return 0;
+        }
+        State->BitBuffer |= (u32)State->Input[State->InputPosition++] << State->BitCount;
+        State->BitCount += 8;
+    }
+    u32 Result = State->BitBuffer & ((1u << Count) - 1);
+    State->BitBuffer >>= Count;
+    State->BitCount -= Count;
+    return Result;
+}
+
+static void InflateBuildHuffman(inflate_huffman *Huffman, const u8 *Lengths, u32 Count)
+{
+    memset(Huffman->Counts, 0, sizeof(Huffman->Counts));
+    for(u32 Symbol = 0; Symbol < Count; ++Symbol) ++Huffman->Counts[Lengths[Symbol]];
+    Huffman->Counts[0] = 0;
+
+    u16 Offsets[16];
+    Offsets[1] = 0;
+    for(u32 Length = 1; Length < 15; ++Length) Offsets[Length + 1] = Offsets[Length] + Huffman->Counts[Length];
+    for(u32 Symbol = 0; Symbol < Count; ++Symbol)
+    {
+        if(Lengths[Symbol]) Huffman->Symbols[Offsets[Lengths[Symbol]]++] = (u16)Symbol;
+    }
+}
+
+// Canonical codes are read one bit at a time, MSB of the code first
+static u32 InflateDecode(inflate_state *State, inflate_huffman *Huffman)
+{
+    s32 Code = 0, First = 0, Index = 0;
+    for(u32 Length = 1; Length < 16; ++Length)
+    {
+        Code |= (s32)InflateBits(State, 1);
+        s32 Count = Huffman->Counts[Length];
+        if(Code - Count < First) return Huffman->Symbols[Index + (Code - First)];
+        Index += Count;
+        First += Count;
+        First <<= 1;
+        Code <<= 1;
+    }
+    State->Error = 1;
+    return 0;
+}
+
+static b32 InflateFixedBlock(inflate_state *State, inflate_huffman *LiteralCodes, inflate_huffman *DistanceCodes)
+{
+    static const u16 LengthBase[29]   = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const u8  LengthExtra[29]  = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const u16 DistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    static const u8  DistanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    for(;;)
+    {
+        u32 Symbol = InflateDecode(State, LiteralCodes);
+        if(State->Error) return 0;
+
+        if(Symbol < 256)
+        {
+            if(State->OutputPosition >= State->OutputSize) return 0;
+            State->Output[State->OutputPosition++] = (u8)Symbol;
+        }
+        else if(Symbol == 256)
+        {
+            return 1;
+        }
+        else
+        {
+            Symbol -= 257;
+            if(Symbol >= 29) return 0;
+            u32 Length = LengthBase[Symbol] + InflateBits(State, LengthExtra[Symbol]);
+
+            u32 DistanceSymbol = InflateDecode(State, DistanceCodes);
+            if(DistanceSymbol >= 30) return 0;
+            u32 Distance = DistanceBase[DistanceSymbol] + InflateBits(State, DistanceExtra[DistanceSymbol]);
+            if(State->Error || Distance > State->OutputPosition || Length > State->OutputSize - State->OutputPosition) return 0;
+
+            for(u32 Index = 0; Index < Length; ++Index, ++State->OutputPosition)
+            {
+                State->Output[State->OutputPosition] = State->Output[State->OutputPosition - Distance];
+            }
+        }
+    }
+}
+
+static const char *Inflate(inflate_state *State)
+{
+    u8 Lengths[288 + 30];
+    for(u32 Symbol = 0; Symbol < 144; ++Symbol) Lengths[Symbol] = 8;
+    for(u32 Symbol = 144; Symbol < 256; ++Symbol) Lengths[Symbol] = 9;
+    for(u32 Symbol = 256; Symbol < 280; ++Symbol) Lengths[Symbol] = 7;
+    for(u32 Symbol = 280; Symbol < 288; ++Symbol) Lengths[Symbol] = 8;
+    for(u32 Symbol = 0; Symbol < 30; ++Symbol) Lengths[288 + Symbol] = 5;
+
+    inflate_huffman LiteralCodes, DistanceCodes;
+    InflateBuildHuffman(&LiteralCodes, Lengths, 288);
+    InflateBuildHuffman(&DistanceCodes, Lengths + 288, 30);
+
+    b32 Last = 0;
+    while(!Last)
+    {
+        Last = InflateBits(State, 1);
+        u32 Type = InflateBits(State, 2);
+        if(State->Error) return "truncated block header";
+
+        if(Type == 0)
+        {
+            State->BitBuffer = 0;
+            State->BitCount  = 0;
+            if(State->InputSize - State->InputPosition < 4) return "truncated stored block";
+            const u8 *Header = State->Input + State->InputPosition;
+            u32 Length  = Header[0] | (Header[1] << 8);
+            u32 Inverse = Header[2] | (Header[3] << 8);
+            State->InputPosition += 4;
+            if((Length ^ 0xFFFF) != Inverse) return "stored block length check";
+            if(State->InputSize - State->InputPosition < Length || State->OutputSize - State->OutputPosition < Length) return "stored block overrun";
+            memcpy(State->Output + State->OutputPosition, State->Input + State->InputPosition, Length);
+            State->InputPosition  += Length;
+            State->OutputPosition += Length;
+        }
+        else if(Type == 1)
+        {
+            if(!InflateFixedBlock(State, &LiteralCodes, &DistanceCodes)) return "bad fixed huffman block";
+        }
+        else
+        {
+            return "dynamic or reserved block";
+        }
+    }
+    return 0;
+}
+
+static u32 ReadBigEndian(const u8 *Data)
+{
+    return ((u32)Data[0] << 24) | ((u32)Data[1] << 16) | ((u32)Data[2] << 8) | (u32)Data[3];
+}
+
+// Bitwise CRC, independent of the encoder's table
+static u32 ReferenceCrc32(const u8 *Data, size_t Size)
+{
+    u32 Crc = 0xFFFFFFFF;
+    for(size_t Index = 0; Index < Size; ++Index)
+    {
+        Crc ^= Data[Index];
+        for(u32 Bit = 0; Bit < 8; ++Bit) Crc = (Crc >> 1) ^ (0xEDB88320 & (0u - (Crc & 1)));
+    }
+    return ~Crc;
+}
+
+static u8 PaethPredictor(s32 A, s32 B, s32 C)
+{
+    s32 P = A + B - C;
+    s32 PA = abs(P - A), PB = abs(P - B), PC = abs(P - C);
+    if(PA <= PB && PA <= PC) return (u8)A;
+    return (u8)((PB <= PC) ? B : C);
+}
+
+// Returns 0 when the PNG decodes to exactly the RGB of the source, or what went wrong
+static const char *CheckPNG(const u8 *Png, size_t PngSize, const u8 *Pixels, u32 Width, u32 Height, u32 Pitch)
+{
+    static const u8 Signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    if(PngSize < 8 || memcmp(Png, Signature, 8) != 0) return "signature";
+
+    u32 RowSize = Width * 3;
+    size_t RawSize = (size_t)(RowSize + 1) * Height;
+    const u8 *Compressed = 0;
+    size_t CompressedSize = 0;
+    b32 SeenHeader = 0, SeenEnd = 0;
+
+    size_t Position = 8;
+    while(!SeenEnd)
+    {
+        if(PngSize - Position < 12) return "truncated chunk";
+        u32 Length = ReadBigEndian(Png + Position);
+        const u8 *Type = Png + Position + 4;
+        if(PngSize - Position - 12 < Length) return "chunk overrun";
+        if(ReferenceCrc32(Type, Length + 4) != ReadBigEndian(Type + 4 + Length)) return "chunk crc";
+
+        const u8 *Data = Type + 4;
+        if(memcmp(Type, "IHDR", 4) == 0)
+        {
+            if(Length != 13 || ReadBigEndian(Data) != Width || ReadBigEndian(Data + 4) != Height) return "header size";
+            if(Data[8] != 8 || Data[9] != 2 || Data[10] || Data[11] || Data[12]) return "header format";
+            SeenHeader = 1;
+        }
+        else if(memcmp(Type, "IDAT", 4) == 0)
+        {
+            if(Compressed) return "more than one IDAT";
+            Compressed = Data;
+            CompressedSize = Length;
+        }
+        else if(memcmp(Type, "IEND", 4) == 0)
+        {
+            SeenEnd = 1;
+        }
+        Position += 12 + Length;
+    }
+    if(!SeenHeader || !Compressed) return "missing chunk";
+    if(Position != PngSize) return "data after IEND";
+
+    if(CompressedSize < 6) return "short zlib stream";
+    if((Compressed[0] & 0x0F) != 8 || ((Compressed[0] << 8) | Compressed[1]) % 31 || (Compressed[1] & 0x20)) return "zlib header";
+
+    u8 *Raw = (u8 *)malloc(RawSize);
+    Assert(Raw);
+    inflate_state State = {0};
+    State.Input      = Compressed + 2;
+    State.InputSize  = CompressedSize - 6;
+    State.Output     = Raw;
+    State.OutputSize = RawSize;
+    const char *Error = Inflate(&State);
+    if(!Error && State.OutputPosition != RawSize) Error = "decoded size";
+    if(!Error && State.InputPosition != State.InputSize) Error = "data after final block";
+
+    if(!Error)
+    {
+        u32 A = 1, B = 0;
+        for(size_t Index = 0; Index < RawSize; ++Index)
+        {
+            A = (A + Raw[Index]) % 65521;
+            B = (B + A) % 65521;
+        }
+        if(((B << 16) | A) != ReadBigEndian(Compressed + CompressedSize - 4)) Error = "adler32";
+    }
+
+    // Unfilter in place, each row reads the already unfiltered row above
+    for(u32 Y = 0; !Error && Y < Height; ++Y)
+    {
+        u8 Filter = Raw[(size_t)Y * (RowSize + 1)];
+        u8 *Row = Raw + (size_t)Y * (RowSize + 1) + 1;
+        u8 *Above = Y ? Row - (RowSize + 1) : 0;
+        for(u32 X = 0; X < RowSize; ++X)
+        {
+            s32 Left = (X >= 3) ? Row[X - 3] : 0;
+            s32 Up = Above ? Above[X] : 0;
+            s32 UpLeft = (Above && X >= 3) ? Above[X - 3] : 0;
+            switch(Filter)
+            {
+                case 0: break;
+                case 1: Row[X] = (u8)(Row[X] + Left); break;
+                case 2: Row[X] = (u8)(Row[X] + Up); break;
+                case 3: Row[X] = (u8)(Row[X] + ((Left + Up) >> 1)); break;
+                case 4: Row[X] = (u8)(Row[X] + PaethPredictor(Left, Up, UpLeft)); break;
+                default: Error = "filter type"; break;
+            }
+        }
+
+        const u8 *Source = Pixels + (size_t)Y * Pitch;
+        for(u32 X = 0; !Error && X < Width; ++X)
+        {
+            if(memcmp(Row + X*3, Source + X*4, 3) != 0) Error = "pixel mismatch";
+        }
+    }
+
+    free(Raw);
+    return Error;
+}
+
+//------------------------------------------------------------------------
+// Capture ring
+
+#define RING_WIDTH 64
+#define RING_HEIGHT 32
+#define RING_PITCH 512
+#define RING_FRAMES 300
+#define RING_FPS 144
+
+static size_t RingFrameSize(capture_format Format)
+{
+    return (Format == CaptureFormat_Y4M) ? 6 + RING_WIDTH * RING_HEIGHT * 3 / 2 : RING_WIDTH * RING_HEIGHT * 4;
+}
+
+// Checks the stream length against the frames captured so far, drops before the first
+// captured frame have nothing to repeat and are not written
+static b32 RingStreamHolds(frame_capture *Capture, s32 *Expected, u32 ExpectedCount)
+{
+    u32 Leading = 0;
+    while(Leading < ExpectedCount && Expected[Leading] < 0) ++Leading;
+
+    encode_buffer Header = {0};
+    if(Capture->Format == CaptureFormat_Y4M)
+    {
+        EncodeY4MHeader(&Header, RING_WIDTH, RING_HEIGHT, RING_FPS);
+    }
+    size_t ExpectedSize = Header.Size + (ExpectedCount - Leading) * RingFrameSize(Capture->Format);
+    EncodeBufferFree(&Header);
+
+    PlatformMutexLock(&Capture->WriteMutex);
+    size_t Size = Capture->Stream ? (size_t)ftell(Capture->Stream) : 0;
+    PlatformMutexUnlock(&Capture->WriteMutex);
+
+    if(Size != ExpectedSize)
+    {
+        printf("ring: stream holds %zu bytes after capture stopped, expected %zu\n", Size, ExpectedSize);
+        return 0;
+    }
+    return 1;
+}
+
+// Renders RING_FRAMES frames with the GPU running Lag frames behind, every Stall frames it
+// stops completing work for a while so the ring fills up and frames are dropped. Capture is
+// switched off for the frames from PauseBegin to PauseEnd, which leave no trace in the stream.
+static b32 RunRing(work_queue *WorkQueue, capture_format Format, u32 Lag, u32 Stall, u32 PauseBegin, u32 PauseEnd)
+{
+    u8 *SlotMemory[CAPTURE_RING_SIZE];
+    for(u32 SlotIndex = 0; SlotIndex < CAPTURE_RING_SIZE; ++SlotIndex)
+    {
+        SlotMemory[SlotIndex] = (u8 *)malloc(RING_PITCH * RING_HEIGHT);
+        Assert(SlotMemory[SlotIndex]);
+    }
+
+    const char *Prefix = "/tmp/linux_bench_image_encode_ring";
+    frame_capture Capture;
+    FrameCaptureInit(&Capture, WorkQueue, Format, Prefix, RING_FPS, RING_WIDTH, RING_HEIGHT, RING_PITCH, SlotMemory);
+
+    // Frame number per frame rendered while capturing, what the stream has to show at that position
+    s32 Expected[RING_FRAMES];
+    u32 ExpectedCount = 0;
+    s32 LastCaptured = -1;
+    u64 CompletedFence = 0;
+    for(u32 Frame = 0; Frame < RING_FRAMES; ++Frame)
+    {
+        if(Frame == PauseBegin)
+        {
+            FrameCaptureStop(&Capture);
+        }
+        if(Frame == PauseEnd && PauseBegin < PauseEnd)
+        {
+            // The GPU has caught up during the pause: the first session, drops included, must
+            // be in the stream already and not be left for the next session to write
+            FrameCaptureRetire(&Capture, CompletedFence);
+            WorkQueueCompleteAll(WorkQueue);
+            if(!RingStreamHolds(&Capture, Expected, ExpectedCount))
+            {
+                return 0;
+            }
+        }
+        b32 Capturing = (Frame < PauseBegin || Frame >= PauseEnd);
+
+        s32 SlotIndex = Capturing ? FrameCaptureAcquire(&Capture) : -1;
+        if(SlotIndex >= 0)
+        {
+            // Gray level encodes the frame, so it survives the Y4M conversion as luma
+            u8 Level = (u8)(16 + (Frame * 7) % 224);
+            for(u32 Y = 0; Y < RING_HEIGHT; ++Y)
+            {
+                memset(SlotMemory[SlotIndex] + Y * RING_PITCH, Level, RING_WIDTH * 4);
+            }
+            FrameCaptureSubmit(&Capture, SlotIndex, Frame + 1, Frame);
+            LastCaptured = (s32)Frame;
+        }
+        if(Capturing)
+        {
+            Expected[ExpectedCount++] = LastCaptured;
+        }
+
+        b32 Stalled = (Stall && (Frame % Stall) >= Stall - 8);
+        if(!Stalled && Frame + 1 > Lag)
+        {
+            CompletedFence = Frame + 1 - Lag;
+        }
+        FrameCaptureRetire(&Capture, CompletedFence);
+        WorkQueueCompleteAll(WorkQueue);
+    }
+    FrameCaptureRetire(&Capture, RING_FRAMES);
+    FrameCaptureShutdown(&Capture);
+
+    u32 Captured = Capture.CapturedFrames;
+    u32 Dropped = Capture.DroppedFrames;
+    for(u32 SlotIndex = 0; SlotIndex < CAPTURE_RING_SIZE; ++SlotIndex)
+    {
+        free(SlotMemory[SlotIndex]);
+    }
+
+    char Path[512];
+    snprintf(Path, sizeof(Path), "%s.%s", Prefix, Format == CaptureFormat_Y4M ? "y4m" : "rgba");
+    FILE *File = fopen(Path, "rb");
+    Assert(File);
+
+    size_t FrameSize = RingFrameSize(Format);
+    if(Format == CaptureFormat_Y4M)
+    {
+        char Header[128];
+        char Rate[32];
+        snprintf(Rate, sizeof(Rate), " F%u:1 ", RING_FPS);
+        if(!fgets(Header, sizeof(Header), File) || strncmp(Header, "YUV4MPEG2 ", 10) != 0 || !strstr(Header, Rate))
+        {
+            printf("ring: bad y4m header, expected%sin %s", Rate, Header);
+            return 0;
+        }
+    }
+
+    // Drops before the first captured frame have nothing to repeat and are left out
+    u32 Leading = 0;
+    while(Leading < ExpectedCount && Expected[Leading] < 0) ++Leading;
+
+    u8 *Buffer = (u8 *)malloc(FrameSize);
+    Assert(Buffer);
+    u32 FramesInFile = 0;
+    b32 Ok = 1;
+    while(Ok && fread(Buffer, 1, FrameSize, File) == FrameSize)
+    {
+        u32 Frame = Leading + FramesInFile++;
+        if(Frame >= ExpectedCount)
+        {
+            printf("ring: more frames in the stream than captured\n");
+            Ok = 0;
+            break;
+        }
+        if(Format == CaptureFormat_Y4M && memcmp(Buffer, "FRAME\n", 6) != 0)
+        {
+            printf("ring: missing FRAME marker at %u\n", Frame);
+            Ok = 0;
+            break;
+        }
+
+        u8 Level = (u8)(16 + ((u32)Expected[Frame] * 7) % 224);
+        u8 Got = (Format == CaptureFormat_Y4M) ? Buffer[6] : Buffer[0];
+        if(Got != Level)
+        {
+            printf("ring: frame %u shows level %u, expected frame %d (level %u)\n", Frame, Got, Expected[Frame], Level);
+            Ok = 0;
+        }
+    }
+    fclose(File);
+    remove(Path);
+    free(Buffer);
+
+    if(Ok && Leading + FramesInFile != ExpectedCount)
+    {
+        printf("ring: %u frames in the stream, %u rendered while capturing\n", FramesInFile, ExpectedCount - Leading);
+        Ok = 0;
+    }
+    if(Ok && (Dropped == 0 || Captured + Dropped != ExpectedCount))
+    {
+        printf("ring: captured %u dropped %u of %u frames\n", Captured, Dropped, ExpectedCount);
+        Ok = 0;
+    }
+
+    printf("ring %-4s lag %u stall %2u pause %3u-%3u: captured %3u dropped %3u, %u frames in stream\n",
+           Format == CaptureFormat_Y4M ? "y4m" : "raw", Lag, Stall, PauseBegin, PauseEnd, Captured, Dropped, FramesInFile);
+    return Ok;
+}
+
+int main(void)
+{
+    ImageEncodeInit();
+
+    // Odd and tiny sizes first, the noisy image defeats matching and stresses literals
+    u32 Sizes[][2] = { { 1, 1 }, { 3, 2 }, { 17, 5 }, { 64, 64 }, { 333, 77 } };
+    for(u32 SizeIndex = 0; SizeIndex < ArrayCount(Sizes); ++SizeIndex)
+    {
+        u32 Width = Sizes[SizeIndex][0], Height = Sizes[SizeIndex][1];
+        u32 Pitch = (Width * 4 + 255) & ~255u;
+        u8 *Pixels = (u8 *)malloc((size_t)Pitch * Height);
+        Assert(Pixels);
+
+        for(u32 Noisy = 0; Noisy < 2; ++Noisy)
+        {
+            FillImage(Pixels, Width, Height, Pitch, Noisy);
+            for(u32 Stored = 0; Stored < 2; ++Stored)
+            {
+                encode_buffer Output = {0}, Scratch = {0};
+                EncodePNG(&Output, &Scratch, Pixels, Width, Height, Pitch, Stored);
+                const char *Error = CheckPNG(Output.Data, Output.Size, Pixels, Width, Height, Pitch);
+                if(Error)
+                {
+                    printf("%ux%u %s%s png: %s\n", Width, Height, Noisy ? "noisy " : "", Stored ? "stored" : "fast", Error);
+                    return 1;
+                }
+                EncodeBufferFree(&Output);
+                EncodeBufferFree(&Scratch);
+            }
+        }
+        free(Pixels);
+    }
+    printf("small and odd sizes round trip\n");
+
+    u32 BenchSizes[][2] = { { 1280, 720 }, { 3840, 2160 } };
+    for(u32 SizeIndex = 0; SizeIndex < ArrayCount(BenchSizes); ++SizeIndex)
+    {
+        u32 Width = BenchSizes[SizeIndex][0], Height = BenchSizes[SizeIndex][1];
+        u32 Pitch = (Width * 4 + 255) & ~255u;
+        u32 Repeats = (SizeIndex == 0) ? 10 : 3;
+        u8 *Pixels = (u8 *)malloc((size_t)Pitch * Height);
+        Assert(Pixels);
+        FillImage(Pixels, Width, Height, Pitch, 0);
+
+        encode_buffer Output = {0}, Scratch = {0};
+        f64 SourceMB = (f64)Width * Height * 3 / 1000000.0;
+
+        for(u32 Stored = 0; Stored < 2; ++Stored)
+        {
+            f64 Start = GetMilliseconds();
+            for(u32 Repeat = 0; Repeat < Repeats; ++Repeat)
+            {
+                Output.Size = 0;
+                EncodePNG(&Output, &Scratch, Pixels, Width, Height, Pitch, Stored);
+            }
+            f64 Ms = (GetMilliseconds() - Start) / Repeats;
+            printf("%4ux%-4u png %-6s %8.2f ms %7.1f MB/s  ratio %.3f\n", Width, Height, Stored ? "stored" : "fast",
+                   Ms, SourceMB / (Ms / 1000.0), (f64)Output.Size / (SourceMB * 1000000.0));
+
+            const char *Error = CheckPNG(Output.Data, Output.Size, Pixels, Width, Height, Pitch);
+            if(Error)
+            {
+                printf("%ux%u %s png: %s\n", Width, Height, Stored ? "stored" : "fast", Error);
+                return 1;
+            }
+        }
+
+        f64 Start = GetMilliseconds();
+        for(u32 Repeat = 0; Repeat < Repeats; ++Repeat)
+        {
+            Output.Size = 0;
+            EncodeY4MFrame(&Output, Pixels, Width, Height, Pitch);
+        }
+        f64 Ms = (GetMilliseconds() - Start) / Repeats;
+        printf("%4ux%-4u y4m        %8.2f ms %7.1f MB/s\n", Width, Height, Ms, SourceMB / (Ms / 1000.0));
+
+        Start = GetMilliseconds();
+        for(u32 Repeat = 0; Repeat < Repeats; ++Repeat)
+        {
+            Output.Size = 0;
+            EncodeRaw(&Output, Pixels, Width, Height, Pitch);
+        }
+        Ms = (GetMilliseconds() - Start) / Repeats;
+        printf("%4ux%-4u raw        %8.2f ms %7.1f MB/s\n", Width, Height, Ms, SourceMB / (Ms / 1000.0));
+
+        EncodeBufferFree(&Output);
+        EncodeBufferFree(&Scratch);
+        free(Pixels);
+    }
+
+    u32 ProcessorCount = PlatformGetProcessorCount();
+    u32 ThreadCount = Minimum(Maximum(ProcessorCount - 1, 3), WORK_QUEUE_MAX_THREADS);
+    work_queue WorkQueue;
+    WorkQueueInit(&WorkQueue, ThreadCount);
+
+    capture_format Formats[] = { CaptureFormat_Raw, CaptureFormat_Y4M };
+    for(u32 FormatIndex = 0; FormatIndex < ArrayCount(Formats); ++FormatIndex)
+    {
+        if(!RunRing(&WorkQueue, Formats[FormatIndex], 2, 40, RING_FRAMES, RING_FRAMES)) return 1;
+        if(!RunRing(&WorkQueue, Formats[FormatIndex], 6, 0, RING_FRAMES, RING_FRAMES)) return 1;
+
+        // Switched off in the middle of a stall, with drops pending behind unwritten slots
+        if(!RunRing(&WorkQueue, Formats[FormatIndex], 2, 40, 118, 160)) return 1;
+        if(!RunRing(&WorkQueue, Formats[FormatIndex], 6, 0, 100, 130)) return 1;
+    }
+
+    WorkQueueShutdown(&WorkQueue);
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,243 @@
+// Benchmarks and checks the scene transform update on Linux
+//
+// Build and run:
+//   gcc -O2 -o linux_bench_scene linux_bench_scene.c -lm -lpthread
+//   ./linux_bench_scene [NodeCount]
+//
+// Builds a random hierarchy (1M nodes by default) twice: as the structure of arrays scene,
+// and as a conventional pointer tree of individually allocated nodes updated recursively.
+// The pointer tree doubles as the reference, every world matrix of the scene is compared
+// against it. Then a few frames of random edits are packed into two upload slices, checking
+// that each slice holds exactly the current matrices after its frame.
+
+#include "scene.h"
+#include "linux_bench_common.h"
+
+#define PACK_STRIDE 64
+#define PACK_SLICES 2
+
+typedef struct tree_node
+{
+    struct tree_node *Parent;
+    struct tree_node **Children;
+    u32 ChildCount;
+    u32 ChildCapacity;
+    v3 Position;
+    v4 Rotation;
+    v3 Scale;
+    m4x4 World;
+} tree_node;
+
+static void TreeAddChild(tree_node *Parent, tree_node *Child)
+{
+    if(Parent->ChildCount == Parent->ChildCapacity)
+    {
+        Parent->ChildCapacity = Parent->ChildCapacity ? 2 * Parent->ChildCapacity : 4;
+        Parent->Children = (tree_node **)realloc(Parent->Children, Parent->ChildCapacity * sizeof(tree_node *));
+        Assert(Parent->Children);
+    }
+    Parent->Children[Parent->ChildCount++] = Child;
+    Child->Parent = Parent;
+}
+
+static void TreeUpdate(tree_node *Node, m4x4 *ParentWorld)
+{
+    m4x4 Local = M4x4FromTRS(Node->Position, Node->Rotation, Node->Scale);
+    Node->World = ParentWorld ? M4x4MulAffine(ParentWorld, &Local) : Local;
+    for(u32 ChildIndex = 0; ChildIndex < Node->ChildCount; ++ChildIndex)
+    {
+        TreeUpdate(Node->Children[ChildIndex], &Node->World);
+    }
+}
+
+static b32 MatricesMatch(m4x4 *A, m4x4 *B)
+{
+    for(u32 Row = 0; Row < 4; ++Row)
+    {
+        for(u32 Column = 0; Column < 4; ++Column)
+        {
+            f32 Expected = B->E[Row][Column];
+            if(fabsf(A->E[Row][Column] - Expected) > 1e-3f * (1.0f + fabsf(Expected))) return 0;
+        }
+    }
+    return 1;
+}
+
+static v4 RandomRotation(void)
+{
+    v4 Rotation = { (f32)(Random() % 200) - 100.0f, (f32)(Random() % 200) - 100.0f, (f32)(Random() % 200) - 100.0f, 100.0f };
+    f32 Length = sqrtf(Rotation.X*Rotation.X + Rotation.Y*Rotation.Y + Rotation.Z*Rotation.Z + Rotation.W*Rotation.W);
+    Rotation.X /= Length; Rotation.Y /= Length; Rotation.Z /= Length; Rotation.W /= Length;
+    return Rotation;
+}
+
+int main(int ArgumentCount, char **Arguments)
+{
+    u32 NodeCount = (ArgumentCount > 1) ? (u32)atoi(Arguments[1]) : 1000000;
+    const u32 RootCount = 16;
+    const u32 Repeats = 5;
+    Assert(NodeCount > RootCount);
+
+    scene Scene;
+    SceneInit(&Scene, NodeCount);
+
+    // Random parents among earlier nodes keep the depth around log(n), well below SCENE_MAX_DEPTH
+    tree_node **Tree = (tree_node **)malloc(NodeCount * sizeof(tree_node *));
+    Assert(Tree);
+    for(u32 Entity = 0; Entity < NodeCount; ++Entity)
+    {
+        // Uneven allocation sizes scatter the tree nodes like a long running heap would
+        Tree[Entity] = (tree_node *)calloc(1, sizeof(tree_node) + Random() % 64);
+        Assert(Tree[Entity]);
+    }
+    for(u32 Entity = 0; Entity < NodeCount; ++Entity)
+    {
+        u32 Parent = (Entity < RootCount) ? SCENE_NO_PARENT : Random() % Entity;
+        v3 Position = { (f32)(Random() % 100) * 0.01f, (f32)(Random() % 100) * 0.01f, (f32)(Random() % 100) * 0.01f };
+        v4 Rotation = RandomRotation();
+        v3 Scale    = { 1.0f, 1.0f, 1.0f };
+
+        tree_node *Node = Tree[Entity];
+        Node->Position = Position;
+        Node->Rotation = Rotation;
+        Node->Scale    = Scale;
+        if(Parent != SCENE_NO_PARENT)
+        {
+            TreeAddChild(Tree[Parent], Node);
+        }
+        SceneAddEntity(&Scene, Parent, Position, Rotation, Scale);
+    }
+
+    f64 Start = GetMilliseconds();
+    SceneSort(&Scene);
+    printf("%u nodes, %u levels, sort %.2f ms\n", NodeCount, Scene.LevelCount, GetMilliseconds() - Start);
+
+    u32 ProcessorCount = PlatformGetProcessorCount();
+    u32 ThreadCount = Minimum(Maximum(ProcessorCount - 1, 3), WORK_QUEUE_MAX_THREADS);
+    work_queue WorkQueue;
+    WorkQueueInit(&WorkQueue, ThreadCount);
+
+    // An empty scene sorts, updates and packs without allocating or touching anything
+    {
+        scene Empty;
+        SceneInit(&Empty, 16);
+        SceneSort(&Empty);
+        scene_pack_target Pack = { .Dest = NULL, .Stride = PACK_STRIDE, .Slice = 0 };
+        SceneUpdateTransforms(&Empty, &WorkQueue, &Pack);
+        Assert(Empty.Sorted && Empty.LevelCount == 0);
+        SceneFree(&Empty);
+    }
+
+    u8 *Slices[PACK_SLICES];
+    for(u32 Slice = 0; Slice < PACK_SLICES; ++Slice)
+    {
+        Slices[Slice] = (u8 *)malloc((size_t)NodeCount * PACK_STRIDE);
+        Assert(Slices[Slice]);
+    }
+
+    f64 TreeMs = 0.0, SerialMs = 0.0, ParallelMs = 0.0, FullPackMs = 0.0;
+    for(u32 Repeat = 0; Repeat < Repeats; ++Repeat)
+    {
+        Start = GetMilliseconds();
+        for(u32 Root = 0; Root < RootCount; ++Root)
+        {
+            TreeUpdate(Tree[Root], NULL);
+        }
+        TreeMs += GetMilliseconds() - Start;
+
+        memset(Scene.Dirty, 1, Scene.Count);
+        Start = GetMilliseconds();
+        SceneUpdateTransforms(&Scene, NULL, NULL);
+        SerialMs += GetMilliseconds() - Start;
+
+        memset(Scene.Dirty, 1, Scene.Count);
+        Start = GetMilliseconds();
+        SceneUpdateTransforms(&Scene, &WorkQueue, NULL);
+        ParallelMs += GetMilliseconds() - Start;
+
+        Start = GetMilliseconds();
+        ScenePackWorldMatrices(&Scene, Slices[0], PACK_STRIDE);
+        FullPackMs += GetMilliseconds() - Start;
+    }
+
+    for(u32 Entity = 0; Entity < NodeCount; ++Entity)
+    {
+        if(!MatricesMatch(&Scene.World[Scene.NodeOfEntity[Entity]], &Tree[Entity]->World))
+        {
+            printf("entity %u does not match the recursive reference\n", Entity);
+            return 1;
+        }
+    }
+
+    // First use of each slice packs everything
+    for(u32 Slice = 0; Slice < PACK_SLICES; ++Slice)
+    {
+        scene_pack_target Pack = { .Dest = Slices[Slice], .Stride = PACK_STRIDE, .Slice = Slice };
+        SceneUpdateTransforms(&Scene, &WorkQueue, &Pack);
+    }
+
+    // Frames of random edits, each packed into its slice only where needed
+    f64 EditedFrameMs = 0.0, StaticFrameMs = 0.0;
+    const u32 FrameCount = 8;
+    const u32 EditsPerFrame = 100;
+    for(u32 Frame = 0; Frame < FrameCount; ++Frame)
+    {
+        for(u32 Edit = 0; Edit < EditsPerFrame; ++Edit)
+        {
+            u32 Entity = Random() % NodeCount;
+            v3 Position = { (f32)(Random() % 100) * 0.01f, 0.0f, 0.0f };
+            v3 Scale    = { 1.0f, 1.0f, 1.0f };
+            v4 Rotation = RandomRotation();
+            Tree[Entity]->Position = Position;
+            Tree[Entity]->Rotation = Rotation;
+            SceneSetLocalTransform(&Scene, Entity, Position, Rotation, Scale);
+        }
+
+        scene_pack_target Pack = { .Dest = Slices[Frame % PACK_SLICES], .Stride = PACK_STRIDE, .Slice = Frame % PACK_SLICES };
+        Start = GetMilliseconds();
+        SceneUpdateTransforms(&Scene, &WorkQueue, &Pack);
+        EditedFrameMs += GetMilliseconds() - Start;
+
+        for(u32 Node = 0; Node < Scene.Count; ++Node)
+        {
+            if(memcmp(Pack.Dest + (size_t)Node * PACK_STRIDE, &Scene.World[Node], sizeof(m4x4)) != 0)
+            {
+                printf("frame %u: slice %u holds a stale matrix for node %u\n", Frame, Pack.Slice, Node);
+                return 1;
+            }
+        }
+    }
+    for(u32 Root = 0; Root < RootCount; ++Root)
+    {
+        TreeUpdate(Tree[Root], NULL);
+    }
+    for(u32 Entity = 0; Entity < NodeCount; ++Entity)
+    {
+        if(!MatricesMatch(&Scene.World[Scene.NodeOfEntity[Entity]], &Tree[Entity]->World))
+        {
+            printf("entity %u does not match the reference after edits\n", Entity);
+            return 1;
+        }
+    }
+
+    // Nothing changes: both slices are current after one more frame each
+    for(u32 Frame = 0; Frame < FrameCount; ++Frame)
+    {
+        scene_pack_target Pack = { .Dest = Slices[Frame % PACK_SLICES], .Stride = PACK_STRIDE, .Slice = Frame % PACK_SLICES };
+        Start = GetMilliseconds();
+        SceneUpdateTransforms(&Scene, &WorkQueue, &Pack);
+        StaticFrameMs += GetMilliseconds() - Start;
+    }
+
+    printf("pointer tree, recursive      %8.2f ms\n", TreeMs / Repeats);
+    printf("soa full update, serial      %8.2f ms\n", SerialMs / Repeats);
+    printf("soa full update, %2u workers  %8.2f ms\n", ThreadCount, ParallelMs / Repeats);
+    printf("full pack, stride %u         %8.2f ms\n", PACK_STRIDE, FullPackMs / Repeats);
+    printf("frame, %u edits + slice pack %8.2f ms\n", EditsPerFrame, EditedFrameMs / FrameCount);
+    printf("frame, static + slice pack   %8.2f ms\n", StaticFrameMs / FrameCount);
+
+    WorkQueueShutdown(&WorkQueue);
+    SceneFree(&Scene);
+    printf("ok\n");
+    return 0;
+}
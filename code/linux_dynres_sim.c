@@ -0,0 +1,238 @@
+// Replays GPU frame time traces through the dynamic resolution controller on Linux
+//
+// Build and run:
+//   gcc -O2 -o linux_dynres_sim linux_dynres_sim.c -lm
+//   ./linux_dynres_sim                      (built-in traces, checks the controller invariants)
+//   ./linux_dynres_sim trace.txt [TargetMs] (replays a recorded trace, prints every frame)
+//
+// A trace holds one GPU frame time in milliseconds per line, measured at full resolution.
+// The simulated frame is assumed pixel bound, so it costs the trace value times the rendered
+// area. Timestamps reach the controller FRAME_LATENCY frames late, like in the renderer.
+//
+// Invariant checked on every frame: the scale only goes up after RaiseDelay consecutive
+// frames that all reported headroom beyond the dead band. A single slow frame may lower it
+// immediately, but nothing that follows can take that back before the delay has passed.
+// The load step trace also bounds undershoot, overshoot and settling time against the scale
+// that renders exactly the target, see CheckStepResponse.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "dynamic_resolution.h"
+
+#define FRAME_LATENCY 2
+#define MAX_TRACE_FRAMES (1 << 20)
+
+typedef struct sim_result
+{
+    u32 Frames;
+    u32 OverBudget;
+    u32 SizeChanges;
+    u32 Violations;
+    f32 MinScale;
+    f32 MeanScale;
+} sim_result;
+
+// Scales, if given, receives the scale every frame was rendered at
+static sim_result Simulate(f32 *Trace, u32 FrameCount, f32 TargetMs, b32 Print, f32 *Scales)
+{
+    sim_result Result = {0};
+    Result.MinScale = 1.0f;
+
+    dynres_controller Controller;
+    DynResInit(&Controller, TargetMs, 0.5f, 1.0f, FRAME_LATENCY);
+
+    f32 Pending[FRAME_LATENCY] = {0};
+    u32 HeadroomRun = 0;
+    u32 LastX = 0;
+    f64 ScaleSum = 0.0;
+
+    for(u32 Frame = 0; Frame < FrameCount; ++Frame)
+    {
+        f32 GpuMs = Trace[Frame] * Controller.Scale * Controller.Scale;
+        if(Scales) Scales[Frame] = Controller.Scale;
+
+        // Oldest frame's timestamps arrive now
+        f32 Reported = Pending[0];
+        for(u32 Index = 0; Index + 1 < FRAME_LATENCY; ++Index)
+        {
+            Pending[Index] = Pending[Index + 1];
+        }
+        Pending[FRAME_LATENCY - 1] = GpuMs;
+
+        f32 OldScale = Controller.Scale;
+        DynResUpdate(&Controller, Reported);
+
+        if(Reported > 0.0f)
+        {
+            // Error above the dead band needs Target/Reported - 1 > Deadband. The controller acts
+            // on max(average, latest), so the latest sample alone already has to qualify.
+            b32 Headroom = Reported * (1.0f + Controller.Deadband) < TargetMs;
+            HeadroomRun = Headroom ? HeadroomRun + 1 : 0;
+
+            if(Controller.Scale > OldScale && HeadroomRun < Controller.RaiseDelay)
+            {
+                ++Result.Violations;
+                printf("  frame %u: scale rose %.3f -> %.3f after %u headroom frames\n", Frame, OldScale, Controller.Scale, HeadroomRun);
+            }
+        }
+
+        u32 RenderX, RenderY;
+        DynResGetRenderSize(&Controller, 1280, 720, &RenderX, &RenderY);
+        if(RenderX != LastX)
+        {
+            ++Result.SizeChanges;
+            LastX = RenderX;
+        }
+
+        if(GpuMs > TargetMs * (1.0f + Controller.Deadband)) ++Result.OverBudget;
+        Result.MinScale = Minimum(Result.MinScale, Controller.Scale);
+        ScaleSum += Controller.Scale;
+
+        if(Print)
+        {
+            printf("%u %.3f %.3f %.3f %ux%u\n", Frame, Trace[Frame], GpuMs, Controller.Scale, RenderX, RenderY);
+        }
+    }
+
+    Result.Frames    = FrameCount;
+    Result.MeanScale = FrameCount ? (f32)(ScaleSum / FrameCount) : 0.0f;
+    return Result;
+}
+
+// Checks the response to a constant load of LoadMs over [Begin, End). The ideal scale renders
+// exactly the target, the band above it is what the dead band tolerates:
+//  - undershoot: once at or above 95% of the ideal, the scale must never drop below it
+//  - overshoot: once inside the band or below it, the scale must never rise above it again
+//  - settling: the scale must stay inside [0.95 ideal, band top] from at most MaxSettle frames
+//    after Begin until End
+static u32 CheckStepResponse(const char *Name, f32 *Scales, u32 Begin, u32 End, f32 LoadMs, f32 TargetMs, u32 MaxSettle)
+{
+    dynres_controller Defaults;
+    DynResInit(&Defaults, TargetMs, 0.5f, 1.0f, FRAME_LATENCY);
+
+    f32 Ideal = Minimum(sqrtf(TargetMs / LoadMs), 1.0f);
+    f32 Low   = 0.95f * Ideal;
+    f32 High  = Minimum(Ideal * sqrtf(1.0f + Defaults.Deadband), 1.0f);
+
+    u32 Failures = 0;
+    b32 NotAbove = 0;
+    b32 NotBelow = 0;
+    u32 Settled = Begin;
+    for(u32 Frame = Begin; Frame < End; ++Frame)
+    {
+        f32 Scale = Scales[Frame];
+        if(Scale <= High)
+        {
+            NotAbove = 1;
+        }
+        else if(NotAbove)
+        {
+            printf("  %s: frame %u overshoots to %.3f, ideal %.3f\n", Name, Frame, Scale, Ideal);
+            ++Failures;
+            NotAbove = 0;
+        }
+        if(Scale >= Low)
+        {
+            NotBelow = 1;
+        }
+        else if(NotBelow)
+        {
+            printf("  %s: frame %u undershoots to %.3f, ideal %.3f\n", Name, Frame, Scale, Ideal);
+            ++Failures;
+            NotBelow = 0;
+        }
+        if(Scale < Low || Scale > High)
+        {
+            Settled = Frame + 1;
+        }
+    }
+    if(Settled - Begin > MaxSettle)
+    {
+        printf("  %s: settles after %u frames, at most %u allowed\n", Name, Settled - Begin, MaxSettle);
+        ++Failures;
+    }
+    printf("  %s: ideal %.3f, settled after %u frames\n", Name, Ideal, Settled - Begin);
+    return Failures;
+}
+
+static void PrintResult(const char *Name, sim_result Result)
+{
+    printf("%-12s frames %5u  over budget %4u  size changes %4u  scale min %.3f mean %.3f  violations %u\n",
+           Name, Result.Frames, Result.OverBudget, Result.SizeChanges, Result.MinScale, Result.MeanScale, Result.Violations);
+}
+
+// Small deterministic generator so the built-in traces are the same on every run
+static f32 Noise(u32 *State)
+{
+    *State = *State * 1664525u + 1013904223u;
+    return (f32)(*State >> 8) / (f32)(1 << 24) - 0.5f;
+}
+
+static int RunBuiltinTraces(f32 *Trace, f32 *Scales)
+{
+    const f32 TargetMs = 14.0f;
+    u32 Failures = 0;
+    u32 Seed = 1;
+
+    // Light load with jitter, should settle at full resolution
+    for(u32 Frame = 0; Frame < 600; ++Frame) Trace[Frame] = 10.0f + Noise(&Seed);
+    sim_result Steady = Simulate(Trace, 600, TargetMs, 0, NULL);
+    PrintResult("steady", Steady);
+    Failures += Steady.Violations + (Steady.MeanScale < 0.99f);
+
+    // Heavy stretch, then back to light load
+    for(u32 Frame = 0; Frame < 600; ++Frame) Trace[Frame] = ((Frame >= 100 && Frame < 300) ? 28.0f : 10.0f) + Noise(&Seed);
+    sim_result Step = Simulate(Trace, 600, TargetMs, 0, Scales);
+    PrintResult("load step", Step);
+    Failures += Step.Violations + (Step.MinScale > 0.8f);
+    Failures += CheckStepResponse("heavy", Scales, 100, 300, 28.0f, TargetMs, 25);
+    Failures += CheckStepResponse("light", Scales, 300, 600, 10.0f, TargetMs, 30);
+
+    // Isolated spikes: each may drop the scale, none may be followed by an early raise
+    for(u32 Frame = 0; Frame < 600; ++Frame) Trace[Frame] = (Frame % 50 == 25) ? 20.0f : 10.0f;
+    sim_result Spikes = Simulate(Trace, 600, TargetMs, 0, NULL);
+    PrintResult("spikes", Spikes);
+    Failures += Spikes.Violations;
+
+    // Load hovering around the budget, exercises the dead band
+    for(u32 Frame = 0; Frame < 600; ++Frame) Trace[Frame] = 14.5f + 2.0f * Noise(&Seed);
+    sim_result Hover = Simulate(Trace, 600, TargetMs, 0, NULL);
+    PrintResult("hover", Hover);
+    Failures += Hover.Violations;
+
+    printf(Failures ? "FAILED\n" : "ok\n");
+    return Failures ? 1 : 0;
+}
+
+int main(int ArgumentCount, char **Arguments)
+{
+    f32 *Trace  = (f32 *)malloc(MAX_TRACE_FRAMES * sizeof(f32));
+    f32 *Scales = (f32 *)malloc(MAX_TRACE_FRAMES * sizeof(f32));
+    Assert(Trace && Scales);
+
+    if(ArgumentCount < 2)
+    {
+        return RunBuiltinTraces(Trace, Scales);
+    }
+
+    FILE *File = fopen(Arguments[1], "r");
+    if(!File)
+    {
+        fprintf(stderr, "Cannot open %s\n", Arguments[1]);
+        return 1;
+    }
+
+    u32 FrameCount = 0;
+    while(FrameCount < MAX_TRACE_FRAMES && fscanf(File, "%f", Trace + FrameCount) == 1)
+    {
+        ++FrameCount;
+    }
+    fclose(File);
+
+    f32 TargetMs = (ArgumentCount > 2) ? (f32)atof(Arguments[2]) : 14.0f;
+
+    printf("# frame trace_ms simulated_ms scale render_size\n");
+    sim_result Result = Simulate(Trace, FrameCount, TargetMs, 1, NULL);
+    PrintResult(Arguments[1], Result);
+    return Result.Violations ? 1 : 0;
+}
@@ -0,0 +1,382 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+// Scene storage
+//
+// Transform hierarchy in structure of arrays form. Nodes are kept sorted breadth first by
+// depth, so every parent precedes its children and a whole level can be updated in parallel
+// once the level above it is done. Entities are stable handles, NodeOfEntity maps them to
+// their current node slot.
+//
+// Matrices are row major and transform column vectors (World * v). They can be uploaded
+// as is to HLSL "row_major float4x4".
+//
+// The update can also write world matrices straight into one of several upload slices
+// (one per frame in flight). A node is written to a slice only when it changed since that
+// slice was last packed, so static nodes cost a flag test per frame instead of a copy.
+
+#include "base.h"
+#include "work_queue.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCENE_NO_PARENT 0xFFFFFFFF
+#define SCENE_MAX_DEPTH 64
+#define SCENE_MAX_JOBS 32
+#define SCENE_PARALLEL_MIN_NODES 4096
+#define SCENE_MAX_PACK_SLICES 8
+
+typedef struct v3 { f32 X, Y, Z; } v3;
+typedef struct v4 { f32 X, Y, Z, W; } v4;
+typedef struct m4x4 { f32 E[4][4]; } m4x4;
+
+static m4x4 M4x4Identity(void)
+{
+    m4x4 Result = {0};
+    Result.E[0][0] = 1.0f;
+    Result.E[1][1] = 1.0f;
+    Result.E[2][2] = 1.0f;
+    Result.E[3][3] = 1.0f;
+    return Result;
+}
+
+// Affine multiply, the bottom row of both matrices is assumed to be (0, 0, 0, 1)
+static m4x4 M4x4MulAffine(m4x4 *A, m4x4 *B)
+{
+    m4x4 Result;
+    for(u32 Row = 0; Row < 3; ++Row)
+    {
+        f32 A0 = A->E[Row][0];
+        f32 A1 = A->E[Row][1];
+        f32 A2 = A->E[Row][2];
+        Result.E[Row][0] = A0*B->E[0][0] + A1*B->E[1][0] + A2*B->E[2][0];
+        Result.E[Row][1] = A0*B->E[0][1] + A1*B->E[1][1] + A2*B->E[2][1];
+        Result.E[Row][2] = A0*B->E[0][2] + A1*B->E[1][2] + A2*B->E[2][2];
+        Result.E[Row][3] = A0*B->E[0][3] + A1*B->E[1][3] + A2*B->E[2][3] + A->E[Row][3];
+    }
+    Result.E[3][0] = 0.0f;
+    Result.E[3][1] = 0.0f;
+    Result.E[3][2] = 0.0f;
+    Result.E[3][3] = 1.0f;
+    return Result;
+}
+
+// Translation * Rotation * Scale, Rotation is a unit quaternion
+static m4x4 M4x4FromTRS(v3 T, v4 R, v3 S)
+{
+    f32 XX = R.X*R.X, YY = R.Y*R.Y, ZZ = R.Z*R.Z;
+    f32 XY = R.X*R.Y, XZ = R.X*R.Z, YZ = R.Y*R.Z;
+    f32 WX = R.W*R.X, WY = R.W*R.Y, WZ = R.W*R.Z;
+
+    m4x4 Result;
+    Result.E[0][0] = (1.0f - 2.0f*(YY + ZZ))*S.X;
+    Result.E[0][1] = (2.0f*(XY - WZ))*S.Y;
+    Result.E[0][2] = (2.0f*(XZ + WY))*S.Z;
+    Result.E[0][3] = T.X;
+    Result.E[1][0] = (2.0f*(XY + WZ))*S.X;
+    Result.E[1][1] = (1.0f - 2.0f*(XX + ZZ))*S.Y;
+    Result.E[1][2] = (2.0f*(YZ - WX))*S.Z;
+    Result.E[1][3] = T.Y;
+    Result.E[2][0] = (2.0f*(XZ - WY))*S.X;
+    Result.E[2][1] = (2.0f*(YZ + WX))*S.Y;
+    Result.E[2][2] = (1.0f - 2.0f*(XX + YY))*S.Z;
+    Result.E[2][3] = T.Z;
+    Result.E[3][0] = 0.0f;
+    Result.E[3][1] = 0.0f;
+    Result.E[3][2] = 0.0f;
+    Result.E[3][3] = 1.0f;
+    return Result;
+}
+
+typedef struct scene scene;
+
+// World matrices go to Dest + Node * Stride, Slice selects which of the caller's copies
+// Dest points at
+typedef struct scene_pack_target
+{
+    u8 *Dest;
+    u32 Stride;
+    u32 Slice;
+} scene_pack_target;
+
+typedef struct scene_update_job
+{
+    scene *Scene;
+    scene_pack_target *Pack;
+    u32 Begin;
+    u32 End;
+} scene_update_job;
+
+struct scene
+{
+    u32 Count;
+    u32 Capacity;
+
+    // Per node, indexed by node slot
+    u32 *Parent;
+    u32 *Depth;
+    u32 *EntityOfNode;
+    v3 *LocalPosition;
+    v4 *LocalRotation;
+    v3 *LocalScale;
+    m4x4 *World;
+    u8 *Dirty;
+    u8 *PackPending; // Bit per pack slice that has not received the current world matrix
+
+    // Per entity
+    u32 *NodeOfEntity;
+
+    // Node ranges of each depth level, valid while Sorted is set
+    b32 Sorted;
+    u32 LevelCount;
+    u32 LevelStart[SCENE_MAX_DEPTH + 1];
+
+    scene_update_job Jobs[SCENE_MAX_JOBS];
+};
+
+static void SceneInit(scene *Scene, u32 Capacity)
+{
+    memset(Scene, 0, sizeof(*Scene));
+    Scene->Capacity = Capacity;
+
+    Scene->Parent        = (u32 *)malloc(Capacity * sizeof(u32));
+    Scene->Depth         = (u32 *)malloc(Capacity * sizeof(u32));
+    Scene->EntityOfNode  = (u32 *)malloc(Capacity * sizeof(u32));
+    Scene->LocalPosition = (v3 *)malloc(Capacity * sizeof(v3));
+    Scene->LocalRotation = (v4 *)malloc(Capacity * sizeof(v4));
+    Scene->LocalScale    = (v3 *)malloc(Capacity * sizeof(v3));
+    Scene->World         = (m4x4 *)malloc(Capacity * sizeof(m4x4));
+    Scene->Dirty         = (u8 *)malloc(Capacity * sizeof(u8));
+    Scene->PackPending   = (u8 *)malloc(Capacity * sizeof(u8));
+    Scene->NodeOfEntity  = (u32 *)malloc(Capacity * sizeof(u32));
+
+    Assert(Scene->Parent && Scene->Depth && Scene->EntityOfNode &&
+           Scene->LocalPosition && Scene->LocalRotation && Scene->LocalScale &&
+           Scene->World && Scene->Dirty && Scene->PackPending && Scene->NodeOfEntity);
+}
+
+static void SceneFree(scene *Scene)
+{
+    free(Scene->Parent);
+    free(Scene->Depth);
+    free(Scene->EntityOfNode);
+    free(Scene->LocalPosition);
+    free(Scene->LocalRotation);
+    free(Scene->LocalScale);
+    free(Scene->World);
+    free(Scene->Dirty);
+    free(Scene->PackPending);
+    free(Scene->NodeOfEntity);
+    memset(Scene, 0, sizeof(*Scene));
+}
+
+// Returns the new entity. ParentEntity is SCENE_NO_PARENT for roots.
+// Appending breaks the depth order, SceneSort has to run before the next update.
+static u32 SceneAddEntity(scene *Scene, u32 ParentEntity, v3 Position, v4 Rotation, v3 Scale)
+{
+    Assert(Scene->Count < Scene->Capacity);
+
+    u32 Entity = Scene->Count;
+    u32 Node   = Scene->Count++;
+
+    u32 ParentNode = SCENE_NO_PARENT;
+    u32 Depth      = 0;
+    if(ParentEntity != SCENE_NO_PARENT)
+    {
+        Assert(ParentEntity < Entity);
+        ParentNode = Scene->NodeOfEntity[ParentEntity];
+        Depth      = Scene->Depth[ParentNode] + 1;
+        Assert(Depth < SCENE_MAX_DEPTH);
+    }
+
+    Scene->Parent[Node]         = ParentNode;
+    Scene->Depth[Node]          = Depth;
+    Scene->EntityOfNode[Node]   = Entity;
+    Scene->LocalPosition[Node]  = Position;
+    Scene->LocalRotation[Node]  = Rotation;
+    Scene->LocalScale[Node]     = Scale;
+    Scene->World[Node]          = M4x4Identity();
+    Scene->Dirty[Node]          = 1;
+    Scene->PackPending[Node]    = 0xFF;
+    Scene->NodeOfEntity[Entity] = Node;
+
+    Scene->Sorted = 0;
+    return Entity;
+}
+
+static void SceneSetLocalTransform(scene *Scene, u32 Entity, v3 Position, v4 Rotation, v3 Scale)
+{
+    u32 Node = Scene->NodeOfEntity[Entity];
+    Scene->LocalPosition[Node] = Position;
+    Scene->LocalRotation[Node] = Rotation;
+    Scene->LocalScale[Node]    = Scale;
+    Scene->Dirty[Node]         = 1;
+}
+
+#define SceneReorderArray(Scene, Array, Type, Order, Temp) \
+    for(u32 Index = 0; Index < (Scene)->Count; ++Index) { ((Type *)(Temp))[Index] = (Scene)->Array[(Order)[Index]]; } \
+    memcpy((Scene)->Array, (Temp), (Scene)->Count * sizeof(Type))
+
+// Stable counting sort of the nodes by depth
+static void SceneSort(scene *Scene)
+{
+    if(Scene->Sorted) return;
+
+    u32 Count = Scene->Count;
+    u32 LevelCounts[SCENE_MAX_DEPTH] = {0};
+    for(u32 Node = 0; Node < Count; ++Node)
+    {
+        ++LevelCounts[Scene->Depth[Node]];
+    }
+
+    Scene->LevelCount = 0;
+    u32 Sum = 0;
+    for(u32 Level = 0; Level < SCENE_MAX_DEPTH; ++Level)
+    {
+        Scene->LevelStart[Level] = Sum;
+        Sum += LevelCounts[Level];
+        if(LevelCounts[Level])
+        {
+            Scene->LevelCount = Level + 1;
+        }
+    }
+    Scene->LevelStart[SCENE_MAX_DEPTH] = Sum;
+
+    // malloc(0) may return NULL, and there is nothing to reorder anyway
+    if(Count == 0)
+    {
+        Scene->Sorted = 1;
+        return;
+    }
+
+    // Order[NewNode] = OldNode, NewOfOld[OldNode] = NewNode
+    u32 *Order    = (u32 *)malloc(Count * sizeof(u32));
+    u32 *NewOfOld = (u32 *)malloc(Count * sizeof(u32));
+    void *Temp    = malloc(Count * sizeof(m4x4));
+    Assert(Order && NewOfOld && Temp);
+
+    u32 Cursor[SCENE_MAX_DEPTH];
+    memcpy(Cursor, Scene->LevelStart, sizeof(Cursor));
+    for(u32 Node = 0; Node < Count; ++Node)
+    {
+        u32 NewNode = Cursor[Scene->Depth[Node]]++;
+        Order[NewNode] = Node;
+        NewOfOld[Node] = NewNode;
+    }
+
+    SceneReorderArray(Scene, Parent,        u32,  Order, Temp);
+    SceneReorderArray(Scene, Depth,         u32,  Order, Temp);
+    SceneReorderArray(Scene, EntityOfNode,  u32,  Order, Temp);
+    SceneReorderArray(Scene, LocalPosition, v3,   Order, Temp);
+    SceneReorderArray(Scene, LocalRotation, v4,   Order, Temp);
+    SceneReorderArray(Scene, LocalScale,    v3,   Order, Temp);
+    SceneReorderArray(Scene, World,         m4x4, Order, Temp);
+    SceneReorderArray(Scene, Dirty,         u8,   Order, Temp);
+
+    for(u32 Node = 0; Node < Count; ++Node)
+    {
+        if(Scene->Parent[Node] != SCENE_NO_PARENT)
+        {
+            Scene->Parent[Node] = NewOfOld[Scene->Parent[Node]];
+        }
+        Scene->NodeOfEntity[Scene->EntityOfNode[Node]] = Node;
+    }
+
+    // Nodes moved to other slots, every slice has to be packed in full again
+    memset(Scene->PackPending, 0xFF, Count);
+
+    free(Temp);
+    free(NewOfOld);
+    free(Order);
+
+    Scene->Sorted = 1;
+}
+
+// Dirty flags are propagated down one level at a time: a node is recomputed when it or
+// its parent changed during this update. Pack may be NULL.
+static void SceneUpdateRange(scene *Scene, scene_pack_target *Pack, u32 Begin, u32 End)
+{
+    for(u32 Node = Begin; Node < End; ++Node)
+    {
+        u32 Parent = Scene->Parent[Node];
+        if(Parent != SCENE_NO_PARENT && Scene->Dirty[Parent])
+        {
+            Scene->Dirty[Node] = 1;
+        }
+
+        if(Scene->Dirty[Node])
+        {
+            m4x4 Local = M4x4FromTRS(Scene->LocalPosition[Node], Scene->LocalRotation[Node], Scene->LocalScale[Node]);
+            Scene->World[Node] = (Parent == SCENE_NO_PARENT) ? Local : M4x4MulAffine(&Scene->World[Parent], &Local);
+            Scene->PackPending[Node] = 0xFF;
+        }
+
+        if(Pack)
+        {
+            u8 SliceBit = (u8)(1u << Pack->Slice);
+            if(Scene->PackPending[Node] & SliceBit)
+            {
+                memcpy(Pack->Dest + (u64)Node * Pack->Stride, &Scene->World[Node], sizeof(m4x4));
+                Scene->PackPending[Node] = (u8)(Scene->PackPending[Node] & ~SliceBit);
+            }
+        }
+    }
+}
+
+static void SceneUpdateJob(void *Data)
+{
+    scene_update_job *Job = (scene_update_job *)Data;
+    SceneUpdateRange(Job->Scene, Job->Pack, Job->Begin, Job->End);
+}
+
+// Recomputes world matrices of changed subtrees. WorkQueue may be NULL.
+// With a Pack target, every matrix that this slice has not seen yet is written to it as well.
+static void SceneUpdateTransforms(scene *Scene, work_queue *WorkQueue, scene_pack_target *Pack)
+{
+    SceneSort(Scene);
+    Assert(!Pack || (Pack->Stride >= sizeof(m4x4) && Pack->Slice < SCENE_MAX_PACK_SLICES));
+
+    u32 JobCount = WorkQueue ? Minimum(WorkQueue->ThreadCount + 1, SCENE_MAX_JOBS) : 1;
+    for(u32 Level = 0; Level < Scene->LevelCount; ++Level)
+    {
+        u32 Begin = Scene->LevelStart[Level];
+        u32 End   = Scene->LevelStart[Level + 1];
+        u32 Count = End - Begin;
+
+        if(JobCount > 1 && Count >= SCENE_PARALLEL_MIN_NODES)
+        {
+            u32 ChunkSize = (Count + JobCount - 1) / JobCount;
+            for(u32 JobIndex = 0; JobIndex < JobCount; ++JobIndex)
+            {
+                scene_update_job *Job = Scene->Jobs + JobIndex;
+                Job->Scene = Scene;
+                Job->Pack  = Pack;
+                Job->Begin = Minimum(Begin + JobIndex * ChunkSize, End);
+                Job->End   = Minimum(Job->Begin + ChunkSize, End);
+                WorkQueueAdd(WorkQueue, SceneUpdateJob, Job);
+            }
+            WorkQueueCompleteAll(WorkQueue);
+        }
+        else
+        {
+            SceneUpdateRange(Scene, Pack, Begin, End);
+        }
+    }
+
+    memset(Scene->Dirty, 0, Scene->Count);
+}
+
+// Writes all world matrices in node order, Stride bytes apart (e.g. 256 for constant buffer views)
+static void ScenePackWorldMatrices(scene *Scene, void *Dest, u32 Stride)
+{
+    Assert(Stride >= sizeof(m4x4));
+    u8 *At = (u8 *)Dest;
+    for(u32 Node = 0; Node < Scene->Count; ++Node)
+    {
+        memcpy(At, &Scene->World[Node], sizeof(m4x4));
+        At += Stride;
+    }
+}
+
+#endif
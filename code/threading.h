@@ -0,0 +1,99 @@
+#ifndef THREADING_H
+#define THREADING_H
+
+// Thin threading layer so the portable modules build on Win32 and on POSIX systems.
+// On Win32 windows.h has to be included before this file.
+
+#include "base.h"
+
+#if defined(_WIN32)
+
+typedef HANDLE             platform_thread;
+typedef SRWLOCK            platform_mutex;
+typedef CONDITION_VARIABLE platform_condvar;
+
+#define PLATFORM_THREAD_PROC(Name) static DWORD WINAPI Name(LPVOID Parameter)
+#define PLATFORM_THREAD_PROC_END() return 0
+typedef LPTHREAD_START_ROUTINE platform_thread_proc;
+
+static void PlatformThreadCreate(platform_thread *Thread, platform_thread_proc Proc, void *Parameter)
+{
+    *Thread = CreateThread(NULL, 0, Proc, Parameter, 0, NULL);
+    Assert(*Thread);
+}
+
+static void PlatformThreadJoin(platform_thread *Thread)
+{
+    WaitForSingleObject(*Thread, INFINITE);
+    CloseHandle(*Thread);
+    *Thread = NULL;
+}
+
+static void PlatformMutexInit(platform_mutex *Mutex)    { InitializeSRWLock(Mutex); }
+static void PlatformMutexDestroy(platform_mutex *Mutex) { (void)Mutex; }
+static void PlatformMutexLock(platform_mutex *Mutex)    { AcquireSRWLockExclusive(Mutex); }
+static void PlatformMutexUnlock(platform_mutex *Mutex)  { ReleaseSRWLockExclusive(Mutex); }
+
+static void PlatformCondvarInit(platform_condvar *Condvar)      { InitializeConditionVariable(Condvar); }
+static void PlatformCondvarDestroy(platform_condvar *Condvar)   { (void)Condvar; }
+static void PlatformCondvarSignal(platform_condvar *Condvar)    { WakeConditionVariable(Condvar); }
+static void PlatformCondvarBroadcast(platform_condvar *Condvar) { WakeAllConditionVariable(Condvar); }
+static void PlatformCondvarWait(platform_condvar *Condvar, platform_mutex *Mutex)
+{
+    SleepConditionVariableSRW(Condvar, Mutex, INFINITE, 0);
+}
+
+static u32 PlatformGetProcessorCount(void)
+{
+    SYSTEM_INFO SystemInfo = {0};
+    GetSystemInfo(&SystemInfo);
+    return SystemInfo.dwNumberOfProcessors;
+}
+
+#else
+
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_t       platform_thread;
+typedef pthread_mutex_t platform_mutex;
+typedef pthread_cond_t  platform_condvar;
+
+#define PLATFORM_THREAD_PROC(Name) static void *Name(void *Parameter)
+#define PLATFORM_THREAD_PROC_END() return NULL
+typedef void *(*platform_thread_proc)(void *);
+
+static void PlatformThreadCreate(platform_thread *Thread, platform_thread_proc Proc, void *Parameter)
+{
+    int Error = pthread_create(Thread, NULL, Proc, Parameter);
+    Assert(Error == 0);
+}
+
+static void PlatformThreadJoin(platform_thread *Thread)
+{
+    pthread_join(*Thread, NULL);
+}
+
+static void PlatformMutexInit(platform_mutex *Mutex)    { pthread_mutex_init(Mutex, NULL); }
+static void PlatformMutexDestroy(platform_mutex *Mutex) { pthread_mutex_destroy(Mutex); }
+static void PlatformMutexLock(platform_mutex *Mutex)    { pthread_mutex_lock(Mutex); }
+static void PlatformMutexUnlock(platform_mutex *Mutex)  { pthread_mutex_unlock(Mutex); }
+
+static void PlatformCondvarInit(platform_condvar *Condvar)      { pthread_cond_init(Condvar, NULL); }
+static void PlatformCondvarDestroy(platform_condvar *Condvar)   { pthread_cond_destroy(Condvar); }
+static void PlatformCondvarSignal(platform_condvar *Condvar)    { pthread_cond_signal(Condvar); }
+static void PlatformCondvarBroadcast(platform_condvar *Condvar) { pthread_cond_broadcast(Condvar); }
+static void PlatformCondvarWait(platform_condvar *Condvar, platform_mutex *Mutex)
+{
+    pthread_cond_wait(Condvar, Mutex);
+}
+
+static u32 PlatformGetProcessorCount(void)
+{
+    long Count = sysconf(_SC_NPROCESSORS_ONLN);
+    return Count > 0 ? (u32)Count : 1;
+}
+
+#endif
+
+#endif
@@ -1,6 +1,7 @@
 // Minimal example of how to set up D3D12 rendering on Windows in C
 
 #define COBJMACROS
+#define _CRT_SECURE_NO_WARNINGS
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
@@ -12,23 +13,14 @@
 #include <d3d12sdklayers.h>
 #pragma warning(pop)
 
-#include <stdint.h>
-typedef uint8_t  u8;
-typedef uint16_t u16;
-typedef uint32_t u32;
-typedef uint64_t u64;
-typedef int8_t   s8;
-typedef int16_t  s16;
-typedef int32_t  s32;
-typedef int64_t  s64;
-typedef float    f32;
-typedef double   f64;
-typedef uint32_t b32;
-
-#define AssertBreak() (*(volatile int *)0 = 0)
-#define Assert(Expression) if(!(Expression)) { AssertBreak(); }
-#define AssertHR(HResult) Assert(SUCCEEDED(HResult))
-#define ArrayCount(Array) (sizeof(Array) / sizeof((Array)[0]))
+#include "base.h"
+#include "dynamic_resolution.h"
+#include "work_queue.h"
+#include "fence_service.h"
+#include "draw_queue.h"
+#include "scene.h"
+#include "image_encode.h"
+#include "frame_capture.h"
 
 #define DEBUG_ENABLED 1
 
@@ -59,6 +51,59 @@ static LRESULT CALLBACK WindowProc(HWND Window, UINT Message, WPARAM WParam, LPA
     return DefWindowProc(Window, Message, WParam, LParam);
 }
 
+// Draw record referenced by draw queue items
+typedef struct scene_draw
+{
+    u32 Entity;
+    D3D12_VERTEX_BUFFER_VIEW VertexBufferView;
+    u32 VertexCount;
+} scene_draw;
+
+typedef struct draw_submit_context
+{
+    ID3D12GraphicsCommandList *CommandList;
+    ID3D12PipelineState **Pipelines;
+    scene_draw *Draws;
+    scene *Scene;
+    D3D12_GPU_VIRTUAL_ADDRESS ObjectConstants;
+    D3D12_GPU_VIRTUAL_ADDRESS CurrentVertexBuffer;
+} draw_submit_context;
+
+static void SubmitSetPipeline(void *Context, u32 Pipeline)
+{
+    draw_submit_context *Submit = (draw_submit_context *)Context;
+    ID3D12GraphicsCommandList_SetPipelineState(Submit->CommandList, Submit->Pipelines[Pipeline]);
+}
+
+static void SubmitSetMaterial(void *Context, u32 Material)
+{
+    // Scene root signature has no material bindings yet
+}
+
+static void SubmitDraw(void *Context, u32 DrawIndex)
+{
+    draw_submit_context *Submit = (draw_submit_context *)Context;
+    scene_draw *Draw = Submit->Draws + DrawIndex;
+
+    if(Draw->VertexBufferView.BufferLocation != Submit->CurrentVertexBuffer)
+    {
+        ID3D12GraphicsCommandList_IASetVertexBuffers(Submit->CommandList, 0, 1, &Draw->VertexBufferView);
+        Submit->CurrentVertexBuffer = Draw->VertexBufferView.BufferLocation;
+    }
+
+    // Object constants are packed in scene node order
+    u32 Node = Submit->Scene->NodeOfEntity[Draw->Entity];
+    D3D12_GPU_VIRTUAL_ADDRESS ObjectConstants = Submit->ObjectConstants + (u64)Node * D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT;
+    ID3D12GraphicsCommandList_SetGraphicsRootConstantBufferView(Submit->CommandList, 0, ObjectConstants);
+    ID3D12GraphicsCommandList_DrawInstanced(Submit->CommandList, Draw->VertexCount, 1, 0, 0);
+}
+
+// Runs on the fence service's waiter thread once a frame with a capture copy has completed
+static void RetireCapturesOnFence(void *Data, u64 CompletedValue)
+{
+    FrameCaptureRetire((frame_capture *)Data, CompletedValue);
+}
+
 int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine, INT ShowCode)
 {
     // Create system window
@@ -68,6 +113,17 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
     u32 ResX = SmallWindow ? 960 : 1280;
     u32 ResY = SmallWindow ? 540 : 720;
 
+    // Render the scene into an offscreen target sized by the dynamic resolution controller
+    // and upscale it to the back buffer. Target stays under the 60Hz vsync interval with some margin.
+    b32 DynamicResolution  = 1;
+    f32 TargetFrameMs      = 14.0f;
+    f32 MinResolutionScale = 0.5f;
+
+    // F11 toggles capturing presented frames into the working directory. Not F12: that is the
+    // debugger break hotkey while a debugger is attached.
+    capture_format CaptureFormat = CaptureFormat_PNG;
+    const char *CapturePath      = "capture";
+
     HWND Window = NULL;
     {
         WNDCLASSEX WindowClass = {0};
@@ -263,7 +319,7 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
     {
         D3D12_DESCRIPTOR_HEAP_DESC DescriptorHeapDesc = {0};
         DescriptorHeapDesc.Type           = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
-        DescriptorHeapDesc.NumDescriptors = ArrayCount(BackBuffers);
+        DescriptorHeapDesc.NumDescriptors = ArrayCount(BackBuffers) + 1; // Back buffers + scene target
         DescriptorHeapDesc.Flags          = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
         DescriptorHeapDesc.NodeMask       = 0;
 
@@ -271,6 +327,19 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
         AssertHR(Result);
     }
 
+    // Create shader visible descriptor heap for the scene target SRV
+    ID3D12DescriptorHeap *SrvDescriptorHeap = NULL;
+    {
+        D3D12_DESCRIPTOR_HEAP_DESC DescriptorHeapDesc = {0};
+        DescriptorHeapDesc.Type           = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+        DescriptorHeapDesc.NumDescriptors = 1;
+        DescriptorHeapDesc.Flags          = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
+        DescriptorHeapDesc.NodeMask       = 0;
+
+        Result = ID3D12Device_CreateDescriptorHeap(Device, &DescriptorHeapDesc, &IID_ID3D12DescriptorHeap, &SrvDescriptorHeap);
+        AssertHR(Result);
+    }
+
     // Create render targets for each frame
     {
         u32 RtvDescriptorSize = ID3D12Device_GetDescriptorHandleIncrementSize(Device, D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
@@ -294,10 +363,100 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
         }
     }
 
-    // Create command allocator
-    ID3D12CommandAllocator *DirectQueueCommandAllocator = NULL;
+    // Create offscreen scene render target at full resolution.
+    // Dynamic resolution only changes the viewport, so resizing never reallocates.
+    const f32 ClearColor[] = { 0.05f, 0.05f, 0.05f, 1.0f };
+    ID3D12Resource *SceneTarget = NULL;
+    D3D12_CPU_DESCRIPTOR_HANDLE SceneRtvDescriptorHandle = {0};
+    D3D12_GPU_DESCRIPTOR_HANDLE SceneSrvDescriptorHandle = {0};
+    {
+        D3D12_HEAP_PROPERTIES HeapProperties = {0};
+        HeapProperties.Type = D3D12_HEAP_TYPE_DEFAULT;
+
+        D3D12_RESOURCE_DESC ResourceDesc = {0};
+        ResourceDesc.Dimension          = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+        ResourceDesc.Alignment          = 0;
+        ResourceDesc.Width              = ResX;
+        ResourceDesc.Height             = ResY;
+        ResourceDesc.DepthOrArraySize   = 1;
+        ResourceDesc.MipLevels          = 1;
+        ResourceDesc.Format             = DXGI_FORMAT_R8G8B8A8_UNORM;
+        ResourceDesc.SampleDesc.Count   = 1;
+        ResourceDesc.SampleDesc.Quality = 0;
+        ResourceDesc.Layout             = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+        ResourceDesc.Flags              = D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET;
+
+        D3D12_CLEAR_VALUE ClearValue = {0};
+        ClearValue.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+        memcpy(ClearValue.Color, ClearColor, sizeof(ClearColor));
+
+        Result = ID3D12Device_CreateCommittedResource(Device, &HeapProperties, D3D12_HEAP_FLAG_NONE, &ResourceDesc, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, &ClearValue, &IID_ID3D12Resource, &SceneTarget);
+        AssertHR(Result);
+
+        // GetCPUDescriptorHandleForHeapStart and GetGPUDescriptorHandleForHeapStart declarations are broken in Windows C interface.
+        // https://joshstaiger.org/notes/C-Language-Problems-in-Direct3D-12-GetCPUDescriptorHandleForHeapStart.html
+        typedef void(get_cpu_descriptor_handle_for_heap_start)(ID3D12DescriptorHeap*, D3D12_CPU_DESCRIPTOR_HANDLE*);
+        typedef void(get_gpu_descriptor_handle_for_heap_start)(ID3D12DescriptorHeap*, D3D12_GPU_DESCRIPTOR_HANDLE*);
+        get_cpu_descriptor_handle_for_heap_start *GetCPUDescriptorHandleForHeapStart = (get_cpu_descriptor_handle_for_heap_start *)RtvDescriptorHeap->lpVtbl->GetCPUDescriptorHandleForHeapStart;
+        get_gpu_descriptor_handle_for_heap_start *GetGPUDescriptorHandleForHeapStart = (get_gpu_descriptor_handle_for_heap_start *)SrvDescriptorHeap->lpVtbl->GetGPUDescriptorHandleForHeapStart;
+
+        // Scene target RTV goes after the back buffer RTVs
+        u32 RtvDescriptorSize = ID3D12Device_GetDescriptorHandleIncrementSize(Device, D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
+        GetCPUDescriptorHandleForHeapStart(RtvDescriptorHeap, &SceneRtvDescriptorHandle);
+        SceneRtvDescriptorHandle.ptr += ArrayCount(BackBuffers) * RtvDescriptorSize;
+        ID3D12Device_CreateRenderTargetView(Device, SceneTarget, NULL, SceneRtvDescriptorHandle);
+
+        D3D12_CPU_DESCRIPTOR_HANDLE SrvCpuDescriptorHandle = {0};
+        GetCPUDescriptorHandleForHeapStart(SrvDescriptorHeap, &SrvCpuDescriptorHandle);
+        ID3D12Device_CreateShaderResourceView(Device, SceneTarget, NULL, SrvCpuDescriptorHandle);
+
+        GetGPUDescriptorHandleForHeapStart(SrvDescriptorHeap, &SceneSrvDescriptorHandle);
+    }
+
+    // Create timestamp queries for measuring GPU frame time
+    ID3D12QueryHeap *TimestampQueryHeap = NULL;
+    ID3D12Resource *TimestampReadback = NULL;
+    u64 TimestampFrequency = 0;
+    {
+        D3D12_QUERY_HEAP_DESC QueryHeapDesc = {0};
+        QueryHeapDesc.Type     = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+        QueryHeapDesc.Count    = 2 * (u32)ArrayCount(BackBuffers); // Frame begin and end, per frame in flight
+        QueryHeapDesc.NodeMask = 0;
+
+        Result = ID3D12Device_CreateQueryHeap(Device, &QueryHeapDesc, &IID_ID3D12QueryHeap, &TimestampQueryHeap);
+        AssertHR(Result);
+
+        D3D12_HEAP_PROPERTIES HeapProperties = {0};
+        HeapProperties.Type = D3D12_HEAP_TYPE_READBACK;
+
+        D3D12_RESOURCE_DESC ResourceDesc = {0};
+        ResourceDesc.Dimension          = D3D12_RESOURCE_DIMENSION_BUFFER;
+        ResourceDesc.Alignment          = 0;
+        ResourceDesc.Width              = QueryHeapDesc.Count * sizeof(u64);
+        ResourceDesc.Height             = 1;
+        ResourceDesc.DepthOrArraySize   = 1;
+        ResourceDesc.MipLevels          = 1;
+        ResourceDesc.Format             = DXGI_FORMAT_UNKNOWN;
+        ResourceDesc.SampleDesc.Count   = 1;
+        ResourceDesc.SampleDesc.Quality = 0;
+        ResourceDesc.Layout             = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+        ResourceDesc.Flags              = D3D12_RESOURCE_FLAG_NONE;
+
+        Result = ID3D12Device_CreateCommittedResource(Device, &HeapProperties, D3D12_HEAP_FLAG_NONE, &ResourceDesc, D3D12_RESOURCE_STATE_COPY_DEST, NULL, &IID_ID3D12Resource, &TimestampReadback);
+        AssertHR(Result);
+
+        Result = ID3D12CommandQueue_GetTimestampFrequency(DirectQueue, &TimestampFrequency);
+        AssertHR(Result);
+    }
+
+    dynres_controller DynRes = {0};
+    DynResInit(&DynRes, TargetFrameMs, MinResolutionScale, 1.0f, (u32)ArrayCount(BackBuffers));
+
+    // Create a command allocator per frame in flight, an allocator can only be reset once the GPU is done with it
+    ID3D12CommandAllocator *DirectQueueCommandAllocators[ArrayCount(BackBuffers)] = {0};
+    for(u32 FrameSlot = 0; FrameSlot < ArrayCount(DirectQueueCommandAllocators); ++FrameSlot)
     {
-        Result = ID3D12Device_CreateCommandAllocator(Device, D3D12_COMMAND_LIST_TYPE_DIRECT, &IID_ID3D12CommandAllocator, &DirectQueueCommandAllocator);
+        Result = ID3D12Device_CreateCommandAllocator(Device, D3D12_COMMAND_LIST_TYPE_DIRECT, &IID_ID3D12CommandAllocator, &DirectQueueCommandAllocators[FrameSlot]);
         AssertHR(Result);
     }
 
@@ -305,12 +464,20 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
     //------------------------------------------------------------------------
     //
 
-    // Create an empty root signature
+    // Create scene root signature with a single root CBV for the per object constants
     ID3D12RootSignature *RootSignature = NULL;
     {
+        D3D12_ROOT_PARAMETER RootParameters[1] = {0};
+        RootParameters[0].ParameterType             = D3D12_ROOT_PARAMETER_TYPE_CBV;
+        RootParameters[0].Descriptor.ShaderRegister = 0;
+        RootParameters[0].Descriptor.RegisterSpace  = 0;
+        RootParameters[0].ShaderVisibility          = D3D12_SHADER_VISIBILITY_VERTEX;
+
         D3D12_VERSIONED_ROOT_SIGNATURE_DESC RootSignatureDesc = {0};
-        RootSignatureDesc.Version        = D3D_ROOT_SIGNATURE_VERSION_1_0;
-        RootSignatureDesc.Desc_1_0.Flags = D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT;
+        RootSignatureDesc.Version                = D3D_ROOT_SIGNATURE_VERSION_1_0;
+        RootSignatureDesc.Desc_1_0.NumParameters = ArrayCount(RootParameters);
+        RootSignatureDesc.Desc_1_0.pParameters   = RootParameters;
+        RootSignatureDesc.Desc_1_0.Flags         = D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT;
 
         ID3DBlob *SerializedRootSignature = NULL;
         Result = D3D12SerializeVersionedRootSignature(&RootSignatureDesc, &SerializedRootSignature, NULL);
@@ -330,6 +497,10 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
         ID3DBlob *PixelShader  = NULL;
 
         const char ShaderSource[] =
+            "cbuffer ObjectConstants : register(b0)\n"
+            "{\n"
+            "   row_major float4x4 World;\n"
+            "};\n"
             "struct PSInput\n"
             "{\n"
             "   float4 position : SV_POSITION;\n"
@@ -338,7 +509,7 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
             "PSInput VSMain(float4 position : POSITION0, float4 color : COLOR0)\n"
             "{\n"
             "   PSInput result;\n"
-            "   result.position = position;\n"
+            "   result.position = mul(World, position);\n"
             "   result.color = color;\n"
             "   return result;\n"
             "}\n"
@@ -442,10 +613,156 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
         ID3D10Blob_Release(PixelShader);
     }
 
+    // Create root signature for the upscale pass: scene target SRV table, UV scale/clamp constants, linear clamp sampler
+    ID3D12RootSignature *UpscaleRootSignature = NULL;
+    {
+        D3D12_DESCRIPTOR_RANGE SrvRange = {0};
+        SrvRange.RangeType                         = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
+        SrvRange.NumDescriptors                    = 1;
+        SrvRange.BaseShaderRegister                = 0;
+        SrvRange.RegisterSpace                     = 0;
+        SrvRange.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
+
+        D3D12_ROOT_PARAMETER RootParameters[2] = {0};
+        RootParameters[0].ParameterType                       = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+        RootParameters[0].DescriptorTable.NumDescriptorRanges = 1;
+        RootParameters[0].DescriptorTable.pDescriptorRanges   = &SrvRange;
+        RootParameters[0].ShaderVisibility                    = D3D12_SHADER_VISIBILITY_PIXEL;
+        RootParameters[1].ParameterType                       = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+        RootParameters[1].Constants.ShaderRegister            = 0;
+        RootParameters[1].Constants.RegisterSpace             = 0;
+        RootParameters[1].Constants.Num32BitValues            = 4;
+        RootParameters[1].ShaderVisibility                    = D3D12_SHADER_VISIBILITY_ALL;
+
+        D3D12_STATIC_SAMPLER_DESC StaticSampler = {0};
+        StaticSampler.Filter           = D3D12_FILTER_MIN_MAG_MIP_LINEAR;
+        StaticSampler.AddressU         = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+        StaticSampler.AddressV         = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+        StaticSampler.AddressW         = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+        StaticSampler.MipLODBias       = 0.0f;
+        StaticSampler.MaxAnisotropy    = 0;
+        StaticSampler.ComparisonFunc   = D3D12_COMPARISON_FUNC_NEVER;
+        StaticSampler.BorderColor      = D3D12_STATIC_BORDER_COLOR_OPAQUE_BLACK;
+        StaticSampler.MinLOD           = 0.0f;
+        StaticSampler.MaxLOD           = D3D12_FLOAT32_MAX;
+        StaticSampler.ShaderRegister   = 0;
+        StaticSampler.RegisterSpace    = 0;
+        StaticSampler.ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+
+        D3D12_VERSIONED_ROOT_SIGNATURE_DESC RootSignatureDesc = {0};
+        RootSignatureDesc.Version                    = D3D_ROOT_SIGNATURE_VERSION_1_0;
+        RootSignatureDesc.Desc_1_0.NumParameters     = ArrayCount(RootParameters);
+        RootSignatureDesc.Desc_1_0.pParameters       = RootParameters;
+        RootSignatureDesc.Desc_1_0.NumStaticSamplers = 1;
+        RootSignatureDesc.Desc_1_0.pStaticSamplers   = &StaticSampler;
+        RootSignatureDesc.Desc_1_0.Flags             = D3D12_ROOT_SIGNATURE_FLAG_NONE;
+
+        ID3DBlob *SerializedRootSignature = NULL;
+        Result = D3D12SerializeVersionedRootSignature(&RootSignatureDesc, &SerializedRootSignature, NULL);
+        AssertHR(Result);
+
+        Result = ID3D12Device_CreateRootSignature(Device, 0, ID3D10Blob_GetBufferPointer(SerializedRootSignature), ID3D10Blob_GetBufferSize(SerializedRootSignature), &IID_ID3D12RootSignature, &UpscaleRootSignature);
+        AssertHR(Result);
+
+        ID3D10Blob_Release(SerializedRootSignature);
+    }
+
+    // Create upscale pipeline state object. Draws a single fullscreen triangle generated from SV_VertexID.
+    ID3D12PipelineState *UpscalePSO = NULL;
+    {
+        ID3DBlob *VertexShader = NULL;
+        ID3DBlob *PixelShader  = NULL;
+
+        const char ShaderSource[] =
+            "cbuffer UpscaleConstants : register(b0)\n"
+            "{\n"
+            "   float2 UVScale;\n"
+            "   float2 UVClamp;\n"
+            "};\n"
+            "Texture2D SceneTexture : register(t0);\n"
+            "SamplerState LinearClamp : register(s0);\n"
+            "struct PSInput\n"
+            "{\n"
+            "   float4 position : SV_POSITION;\n"
+            "   float2 uv : TEXCOORD0;\n"
+            "};\n"
+            "PSInput VSMain(uint id : SV_VertexID)\n"
+            "{\n"
+            "   PSInput result;\n"
+            "   float2 uv = float2((id << 1) & 2, id & 2);\n"
+            "   result.position = float4(uv * float2(2.0, -2.0) + float2(-1.0, 1.0), 0.0, 1.0);\n"
+            "   result.uv = uv * UVScale;\n"
+            "   return result;\n"
+            "}\n"
+            "float4 PSMain(PSInput input) : SV_TARGET\n"
+            "{\n"
+            "   return SceneTexture.Sample(LinearClamp, min(input.uv, UVClamp));\n"
+            "}\n";
+
+        u32 CompilationFlags = 0;
+        #if DEBUG_ENABLED
+        {
+            CompilationFlags |= D3DCOMPILE_DEBUG;
+            CompilationFlags |= D3DCOMPILE_SKIP_OPTIMIZATION;
+        }
+        #endif
+
+        Result = D3DCompile(ShaderSource, ArrayCount(ShaderSource), NULL, NULL, NULL, "VSMain", "vs_5_0", CompilationFlags, 0, &VertexShader, NULL);
+        AssertHR(Result);
+
+        Result = D3DCompile(ShaderSource, ArrayCount(ShaderSource), NULL, NULL, NULL, "PSMain", "ps_5_0", CompilationFlags, 0, &PixelShader, NULL);
+        AssertHR(Result);
+
+        D3D12_RENDER_TARGET_BLEND_DESC DefaultBlendState = {0};
+        DefaultBlendState.BlendEnable           = FALSE;
+        DefaultBlendState.LogicOpEnable         = FALSE;
+        DefaultBlendState.SrcBlend              = D3D12_BLEND_ONE;
+        DefaultBlendState.DestBlend             = D3D12_BLEND_ZERO;
+        DefaultBlendState.BlendOp               = D3D12_BLEND_OP_ADD;
+        DefaultBlendState.SrcBlendAlpha         = D3D12_BLEND_ONE;
+        DefaultBlendState.DestBlendAlpha        = D3D12_BLEND_ZERO;
+        DefaultBlendState.BlendOpAlpha          = D3D12_BLEND_OP_ADD;
+        DefaultBlendState.LogicOp               = D3D12_LOGIC_OP_NOOP;
+        DefaultBlendState.RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_ALL;
+
+        D3D12_GRAPHICS_PIPELINE_STATE_DESC PsoDesc = {0};
+        PsoDesc.pRootSignature                        = UpscaleRootSignature;
+        PsoDesc.VS.pShaderBytecode                    = ID3D10Blob_GetBufferPointer(VertexShader);
+        PsoDesc.VS.BytecodeLength                     = ID3D10Blob_GetBufferSize(VertexShader);
+        PsoDesc.PS.pShaderBytecode                    = ID3D10Blob_GetBufferPointer(PixelShader);
+        PsoDesc.PS.BytecodeLength                     = ID3D10Blob_GetBufferSize(PixelShader);
+        PsoDesc.BlendState.AlphaToCoverageEnable      = FALSE;
+        PsoDesc.BlendState.IndependentBlendEnable     = FALSE;
+        PsoDesc.BlendState.RenderTarget[0]            = DefaultBlendState;
+        PsoDesc.SampleMask                            = 0xFFFFFFFF;
+        PsoDesc.RasterizerState.FillMode              = D3D12_FILL_MODE_SOLID;
+        PsoDesc.RasterizerState.CullMode              = D3D12_CULL_MODE_NONE;
+        PsoDesc.RasterizerState.FrontCounterClockwise = FALSE;
+        PsoDesc.RasterizerState.DepthClipEnable       = TRUE;
+        PsoDesc.RasterizerState.ConservativeRaster    = D3D12_CONSERVATIVE_RASTERIZATION_MODE_OFF;
+        PsoDesc.DepthStencilState.DepthEnable         = FALSE;
+        PsoDesc.DepthStencilState.StencilEnable       = FALSE;
+        PsoDesc.InputLayout.pInputElementDescs        = NULL;
+        PsoDesc.InputLayout.NumElements               = 0;
+        PsoDesc.PrimitiveTopologyType                 = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+        PsoDesc.NumRenderTargets                      = 1;
+        PsoDesc.RTVFormats[0]                         = DXGI_FORMAT_R8G8B8A8_UNORM;
+        PsoDesc.DSVFormat                             = DXGI_FORMAT_UNKNOWN;
+        PsoDesc.SampleDesc.Count                      = 1;
+        PsoDesc.SampleDesc.Quality                    = 0;
+        PsoDesc.NodeMask                              = 0;
+
+        Result = ID3D12Device_CreateGraphicsPipelineState(Device, &PsoDesc, &IID_ID3D12PipelineState, &UpscalePSO);
+        AssertHR(Result);
+
+        ID3D10Blob_Release(VertexShader);
+        ID3D10Blob_Release(PixelShader);
+    }
+
     // Create the command list from the command allocator
     ID3D12GraphicsCommandList *CommandList = NULL;
     {
-        Result = ID3D12Device_CreateCommandList(Device, 0, D3D12_COMMAND_LIST_TYPE_DIRECT, DirectQueueCommandAllocator, PSO, &IID_ID3D12CommandList, &CommandList);
+        Result = ID3D12Device_CreateCommandList(Device, 0, D3D12_COMMAND_LIST_TYPE_DIRECT, DirectQueueCommandAllocators[0], PSO, &IID_ID3D12CommandList, &CommandList);
         AssertHR(Result);
 
         // Command lists are created in the recording state, but there is nothing
@@ -504,43 +821,180 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
     }
 
 
-    // Create synchronization objects and wait until assets have been uploaded to the GPU
-    ID3D12Fence *Fence = NULL;
-    HANDLE FenceEvent = NULL;
-    u64 FenceValue = 0;
+    // Create scene hierarchy. The triangle hangs off a root entity at the origin.
+    scene Scene = {0};
+    u32 TriangleEntity = 0;
     {
-        Result = ID3D12Device_CreateFence(Device, FenceValue, D3D12_FENCE_FLAG_NONE, &IID_ID3D12Fence, &Fence);
+        v3 Position = { 0.0f, 0.0f, 0.0f };
+        v4 Rotation = { 0.0f, 0.0f, 0.0f, 1.0f };
+        v3 Scale    = { 1.0f, 1.0f, 1.0f };
+
+        SceneInit(&Scene, 1024);
+        Assert(ArrayCount(BackBuffers) <= SCENE_MAX_PACK_SLICES);
+        u32 RootEntity = SceneAddEntity(&Scene, SCENE_NO_PARENT, Position, Rotation, Scale);
+        TriangleEntity = SceneAddEntity(&Scene, RootEntity, Position, Rotation, Scale);
+    }
+
+    // Create per frame object constants upload buffer, one 256 byte aligned slot per scene node.
+    // It stays mapped for the lifetime of the application.
+    ID3D12Resource *ObjectConstantsBuffer = NULL;
+    u8 *ObjectConstantsMapped = NULL;
+    u64 ObjectConstantsFrameSize = (u64)Scene.Capacity * D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT;
+    {
+        D3D12_HEAP_PROPERTIES HeapProperties = {0};
+        HeapProperties.Type = D3D12_HEAP_TYPE_UPLOAD;
+
+        D3D12_RESOURCE_DESC ResourceDesc = {0};
+        ResourceDesc.Dimension          = D3D12_RESOURCE_DIMENSION_BUFFER;
+        ResourceDesc.Alignment          = 0;
+        ResourceDesc.Width              = ObjectConstantsFrameSize * ArrayCount(BackBuffers);
+        ResourceDesc.Height             = 1;
+        ResourceDesc.DepthOrArraySize   = 1;
+        ResourceDesc.MipLevels          = 1;
+        ResourceDesc.Format             = DXGI_FORMAT_UNKNOWN;
+        ResourceDesc.SampleDesc.Count   = 1;
+        ResourceDesc.SampleDesc.Quality = 0;
+        ResourceDesc.Layout             = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+        ResourceDesc.Flags              = D3D12_RESOURCE_FLAG_NONE;
+
+        Result = ID3D12Device_CreateCommittedResource(Device, &HeapProperties, D3D12_HEAP_FLAG_NONE, &ResourceDesc, D3D12_RESOURCE_STATE_GENERIC_READ, NULL, &IID_ID3D12Resource, &ObjectConstantsBuffer);
         AssertHR(Result);
 
-        ++FenceValue;
+        D3D12_RANGE ReadRange = {0};
+        Result = ID3D12Resource_Map(ObjectConstantsBuffer, 0, &ReadRange, &ObjectConstantsMapped);
+        AssertHR(Result);
+    }
+
+    // Scene draws are recorded through a sorted draw queue, pipelines are addressed by the key's pipeline ID
+    ID3D12PipelineState *Pipelines[] = { PSO };
+    scene_draw SceneDraws[] =
+    {
+        {
+            .Entity           = TriangleEntity,
+            .VertexBufferView = VertexBufferView,
+            .VertexCount      = 3
+        }
+    };
+
+    work_queue WorkQueue = {0};
+    {
+        u32 ProcessorCount = PlatformGetProcessorCount();
+        WorkQueueInit(&WorkQueue, Minimum(ProcessorCount - 1, WORK_QUEUE_MAX_THREADS));
+    }
+
+    draw_queue DrawQueue = {0};
+    DrawQueueInit(&DrawQueue, 4096);
+
 
-        FenceEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
-        Assert(FenceEvent);
+    // Create readback ring for frame capture. Back buffers are copied into placed footprints
+    // of one readback buffer, which stays mapped so encoders can read finished slots directly.
+    ID3D12Resource *CaptureReadback = NULL;
+    D3D12_PLACED_SUBRESOURCE_FOOTPRINT CaptureFootprints[CAPTURE_RING_SIZE] = {0};
+    work_queue CaptureWorkQueue = {0};
+    frame_capture Capture = {0};
+    {
+        // GetDesc declaration is broken in Windows C interface as well, describe the back buffer directly
+        D3D12_RESOURCE_DESC BackBufferDesc = {0};
+        BackBufferDesc.Dimension          = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+        BackBufferDesc.Width              = ResX;
+        BackBufferDesc.Height             = ResY;
+        BackBufferDesc.DepthOrArraySize   = 1;
+        BackBufferDesc.MipLevels          = 1;
+        BackBufferDesc.Format             = DXGI_FORMAT_R8G8B8A8_UNORM;
+        BackBufferDesc.SampleDesc.Count   = 1;
+        BackBufferDesc.SampleDesc.Quality = 0;
+        BackBufferDesc.Layout             = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+        BackBufferDesc.Flags              = D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET;
+
+        D3D12_PLACED_SUBRESOURCE_FOOTPRINT Footprint = {0};
+        u64 SlotSize = 0;
+        ID3D12Device_GetCopyableFootprints(Device, &BackBufferDesc, 0, 1, 0, &Footprint, NULL, NULL, &SlotSize);
+        SlotSize = (SlotSize + D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT - 1) & ~(u64)(D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT - 1);
+
+        D3D12_HEAP_PROPERTIES HeapProperties = {0};
+        HeapProperties.Type = D3D12_HEAP_TYPE_READBACK;
+
+        D3D12_RESOURCE_DESC ResourceDesc = {0};
+        ResourceDesc.Dimension          = D3D12_RESOURCE_DIMENSION_BUFFER;
+        ResourceDesc.Alignment          = 0;
+        ResourceDesc.Width              = SlotSize * CAPTURE_RING_SIZE;
+        ResourceDesc.Height             = 1;
+        ResourceDesc.DepthOrArraySize   = 1;
+        ResourceDesc.MipLevels          = 1;
+        ResourceDesc.Format             = DXGI_FORMAT_UNKNOWN;
+        ResourceDesc.SampleDesc.Count   = 1;
+        ResourceDesc.SampleDesc.Quality = 0;
+        ResourceDesc.Layout             = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+        ResourceDesc.Flags              = D3D12_RESOURCE_FLAG_NONE;
+
+        Result = ID3D12Device_CreateCommittedResource(Device, &HeapProperties, D3D12_HEAP_FLAG_NONE, &ResourceDesc, D3D12_RESOURCE_STATE_COPY_DEST, NULL, &IID_ID3D12Resource, &CaptureReadback);
+        AssertHR(Result);
 
-        // Wait for the command queue to complete execution
+        u8 *Mapped = NULL;
+        Result = ID3D12Resource_Map(CaptureReadback, 0, NULL, &Mapped);
+        AssertHR(Result);
+
+        u8 *SlotMemory[CAPTURE_RING_SIZE] = {0};
+        for(u32 SlotIndex = 0; SlotIndex < CAPTURE_RING_SIZE; ++SlotIndex)
         {
-            u64 CurrentFenceValue = FenceValue;
+            CaptureFootprints[SlotIndex] = Footprint;
+            CaptureFootprints[SlotIndex].Offset = SlotIndex * SlotSize;
+            SlotMemory[SlotIndex] = Mapped + SlotIndex * SlotSize;
+        }
 
-            // Issue signaling fence from the GPU.
-            // The fence is not signaled immediately but is only signaled once the GPU command queue has reached that point during execution.
-            // Any commands that have been queued before the signal method was invoked must complete execution before the fence will be signaled.
-            Result = ID3D12CommandQueue_Signal(DirectQueue, Fence, CurrentFenceValue);
-            AssertHR(Result);
+        // Encoders get their own workers, so waiting for render jobs never waits for an encode
+        u32 ProcessorCount = PlatformGetProcessorCount();
+        WorkQueueInit(&CaptureWorkQueue, Maximum(ProcessorCount / 2, 1));
 
-            ++FenceValue;
+        // Frames are presented with a sync interval of 1, so a stream frame lasts one refresh of
+        // the output the window is on. Frequencies 0 and 1 stand for the hardware default.
+        u32 FramesPerSecond = 60;
+        IDXGIOutput *Output = NULL;
+        if(SUCCEEDED(IDXGISwapChain1_GetContainingOutput(SwapChain, &Output)))
+        {
+            DXGI_OUTPUT_DESC OutputDesc = {0};
+            Result = IDXGIOutput_GetDesc(Output, &OutputDesc);
+            AssertHR(Result);
 
-            u64 Completed = ID3D12Fence_GetCompletedValue(Fence);
-            if(Completed < CurrentFenceValue)
+            DEVMODEW DisplayMode = {0};
+            DisplayMode.dmSize = sizeof(DisplayMode);
+            if(EnumDisplaySettingsW(OutputDesc.DeviceName, ENUM_CURRENT_SETTINGS, &DisplayMode) && DisplayMode.dmDisplayFrequency > 1)
             {
-                // Specify event to be signaled when the fence reaches given value
-                Result = ID3D12Fence_SetEventOnCompletion(Fence, CurrentFenceValue, FenceEvent);
-                AssertHR(Result);
-
-                // Blocking wait util event is signaled
-                WaitForSingleObject(FenceEvent, INFINITE);
+                FramesPerSecond = DisplayMode.dmDisplayFrequency;
             }
-            BackBufferIndex = IDXGISwapChain3_GetCurrentBackBufferIndex(SwapChain);
+            IDXGIOutput_Release(Output);
         }
+
+        FrameCaptureInit(&Capture, &CaptureWorkQueue, CaptureFormat, CapturePath, FramesPerSecond, ResX, ResY, Footprint.Footprint.RowPitch, SlotMemory);
+    }
+
+
+    // Create synchronization objects and wait until assets have been uploaded to the GPU.
+    // Nothing blocks on the fence directly: the fence service's waiter thread runs callbacks
+    // registered for fence values and wakes anyone waiting in FenceServiceWait.
+    ID3D12Fence *Fence = NULL;
+    fence_service FenceService = {0};
+    u32 DirectFenceID = 0;
+    u64 FenceValue = 0;
+    {
+        Result = ID3D12Device_CreateFence(Device, FenceValue, D3D12_FENCE_FLAG_NONE, &IID_ID3D12Fence, &Fence);
+        AssertHR(Result);
+
+        ++FenceValue;
+
+        FenceServiceInit(&FenceService, 256);
+        DirectFenceID = FenceServiceAddFence(&FenceService, Fence);
+
+        // Issue signaling fence from the GPU.
+        // The fence is not signaled immediately but is only signaled once the GPU command queue has reached that point during execution.
+        // Any commands that have been queued before the signal method was invoked must complete execution before the fence will be signaled.
+        Result = ID3D12CommandQueue_Signal(DirectQueue, Fence, FenceValue);
+        AssertHR(Result);
+
+        FenceServiceWait(&FenceService, DirectFenceID, FenceValue);
+        ++FenceValue;
+
+        BackBufferIndex = IDXGISwapChain3_GetCurrentBackBufferIndex(SwapChain);
     }
 
 
@@ -549,6 +1003,13 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
 
     ShowWindow(Window, SW_SHOWDEFAULT);
 
+    // Selects the per frame slice of the upload buffers, allocators and timestamp queries.
+    // Each slice remembers the fence value of the last frame that used it.
+    u32 FrameIndex = 0;
+    u64 FrameNumber = 0;
+    u64 FrameFenceValues[ArrayCount(BackBuffers)] = {0};
+    b32 Capturing = 0;
+
     for(;;)
     {
         MSG Message = {0};
@@ -558,19 +1019,80 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
             {
                 break;
             }
+            if(Message.message == WM_KEYDOWN && Message.wParam == VK_F11 && !(Message.lParam & (1 << 30)))
+            {
+                Capturing = !Capturing;
+                if(!Capturing)
+                {
+                    FrameCaptureStop(&Capture);
+                }
+            }
             TranslateMessage(&Message);
             DispatchMessageA(&Message);
             continue;
         }
 
+        // Wait until the GPU is done with the frame that last used this slice. With a frame in
+        // flight per back buffer this only blocks when the GPU falls behind the CPU.
+        FenceServiceWait(&FenceService, DirectFenceID, FrameFenceValues[FrameIndex]);
+
+        // That frame's timestamps are now available, feed its duration to the dynamic resolution
+        // controller. Durations arrive a frame in flight per back buffer late, the controller
+        // skips the ones recorded before its last resolution change.
+        if(DynamicResolution && FrameFenceValues[FrameIndex] != 0)
+        {
+            u64 *Timestamps = NULL;
+            D3D12_RANGE ReadRange = { 2 * FrameIndex * sizeof(u64), 2 * (FrameIndex + 1) * sizeof(u64) };
+
+            Result = ID3D12Resource_Map(TimestampReadback, 0, &ReadRange, &Timestamps);
+            AssertHR(Result);
+
+            u64 *FrameTimestamps = Timestamps + 2 * FrameIndex;
+            f32 GpuMs = (f32)((f64)(FrameTimestamps[1] - FrameTimestamps[0]) * 1000.0 / (f64)TimestampFrequency);
+
+            D3D12_RANGE WrittenRange = {0};
+            ID3D12Resource_Unmap(TimestampReadback, 0, &WrittenRange);
+
+            DynResUpdate(&DynRes, GpuMs);
+        }
+
+        // Update scene transforms and upload world matrices for this frame
+        u64 ObjectConstantsOffset = FrameIndex * ObjectConstantsFrameSize;
+        {
+            // Only matrices that changed since this slice was last used are written
+            scene_pack_target Pack =
+            {
+                .Dest   = ObjectConstantsMapped + ObjectConstantsOffset,
+                .Stride = D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT,
+                .Slice  = FrameIndex,
+            };
+            SceneUpdateTransforms(&Scene, &WorkQueue, &Pack);
+        }
+
+        // Pick a readback slot for this frame, the frame is skipped when encoders are behind
+        s32 CaptureSlot = Capturing ? FrameCaptureAcquire(&Capture) : -1;
+
         // Record all the commands we need to render the scene into the command list
         {
-            Result = ID3D12CommandAllocator_Reset(DirectQueueCommandAllocator);
+            ID3D12CommandAllocator *CommandAllocator = DirectQueueCommandAllocators[FrameIndex];
+
+            Result = ID3D12CommandAllocator_Reset(CommandAllocator);
             AssertHR(Result);
 
-            Result = ID3D12GraphicsCommandList_Reset(CommandList, DirectQueueCommandAllocator, PSO);
+            Result = ID3D12GraphicsCommandList_Reset(CommandList, CommandAllocator, PSO);
             AssertHR(Result);
 
+            // Begin GPU frame timing
+            ID3D12GraphicsCommandList_EndQuery(CommandList, TimestampQueryHeap, D3D12_QUERY_TYPE_TIMESTAMP, 2 * FrameIndex);
+
+            // Scene is rendered into the top left corner of the scene target at the controller's resolution
+            u32 RenderX = ResX;
+            u32 RenderY = ResY;
+            if(DynamicResolution)
+            {
+                DynResGetRenderSize(&DynRes, ResX, ResY, &RenderX, &RenderY);
+            }
+
             // Sets the layout of the graphics root signature
             ID3D12GraphicsCommandList_SetGraphicsRootSignature(CommandList, RootSignature);
 
@@ -581,8 +1103,8 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
                     {
                         .TopLeftX = 0.0f,
                         .TopLeftY = 0.0f,
-                        .Width    = (f32)ResX,
-                        .Height   = (f32)ResY,
+                        .Width    = (f32)RenderX,
+                        .Height   = (f32)RenderY,
                         .MinDepth = 0.0f,
                         .MaxDepth = 0.0f
                     }
@@ -591,24 +1113,83 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
             }
 
             // Binds an array of scissor rectangles to the rasterizer stage
+            D3D12_RECT ScissorRectangles[] = 
             {
-                D3D12_RECT ScissorRectangles[] = 
+                {
+                    .left   = 0,
+                    .top    = 0,
+                    .right  = RenderX,
+                    .bottom = RenderY
+                }
+            };
+            ID3D12GraphicsCommandList_RSSetScissorRects(CommandList, ArrayCount(ScissorRectangles), ScissorRectangles);
+
+            // Indicate that the scene target will be used as a render target
+            {
+                D3D12_RESOURCE_BARRIER ResourceBarriers[] = 
                 {
                     {
-                        .left   = 0,
-                        .top    = 0,
-                        .right  = ResX,
-                        .bottom = ResY
+                        .Type       = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION,
+                        .Flags      = D3D12_RESOURCE_BARRIER_FLAG_NONE,
+                        .Transition = 
+                        {
+                            .pResource   = SceneTarget,
+                            .StateBefore = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+                            .StateAfter  = D3D12_RESOURCE_STATE_RENDER_TARGET,
+                            .Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES
+                        }
                     }
                 };
-                ID3D12GraphicsCommandList_RSSetScissorRects(CommandList, ArrayCount(ScissorRectangles), ScissorRectangles);
+                ID3D12GraphicsCommandList_ResourceBarrier(CommandList, ArrayCount(ResourceBarriers), ResourceBarriers);
+
+                ID3D12GraphicsCommandList_OMSetRenderTargets(CommandList, 1, &SceneRtvDescriptorHandle, FALSE, NULL);
+            }
+
+            // Record scene commands
+            {
+                ID3D12GraphicsCommandList_ClearRenderTargetView(CommandList, SceneRtvDescriptorHandle, ClearColor, ArrayCount(ScissorRectangles), ScissorRectangles);
+                ID3D12GraphicsCommandList_IASetPrimitiveTopology(CommandList, D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+                DrawQueueReset(&DrawQueue);
+                for(u32 DrawIndex = 0; DrawIndex < ArrayCount(SceneDraws); ++DrawIndex)
+                {
+                    u64 Key = DrawKeyPack(0, DrawPass_Opaque, 0, 0, DrawKeyQuantizeDepth(0.0f));
+                    DrawQueuePush(&DrawQueue, Key, DrawIndex);
+                }
+                DrawQueueSort(&DrawQueue, &WorkQueue);
+
+                draw_submit_context SubmitContext = {0};
+                SubmitContext.CommandList     = CommandList;
+                SubmitContext.Pipelines       = Pipelines;
+                SubmitContext.Draws           = SceneDraws;
+                SubmitContext.Scene           = &Scene;
+                SubmitContext.ObjectConstants = ID3D12Resource_GetGPUVirtualAddress(ObjectConstantsBuffer) + ObjectConstantsOffset;
+
+                draw_submit_callbacks SubmitCallbacks = {0};
+                SubmitCallbacks.Context     = &SubmitContext;
+                SubmitCallbacks.SetPipeline = SubmitSetPipeline;
+                SubmitCallbacks.SetMaterial = SubmitSetMaterial;
+                SubmitCallbacks.Draw        = SubmitDraw;
+
+                DrawQueueSubmit(&DrawQueue, &SubmitCallbacks);
             }
 
-            // Indicate that the back buffer will be used as a render target
+            // Indicate that the scene target will be sampled and the back buffer will be used as a render target
             D3D12_CPU_DESCRIPTOR_HANDLE RtvDescriptorHandle = {0};
             {
                 D3D12_RESOURCE_BARRIER ResourceBarriers[] = 
                 {
+                    {
+                        .Type       = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION,
+                        .Flags      = D3D12_RESOURCE_BARRIER_FLAG_NONE,
+                        .Transition = 
+                        {
+                            .pResource   = SceneTarget,
+                            .StateBefore = D3D12_RESOURCE_STATE_RENDER_TARGET,
+                            .StateAfter  = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+                            .Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES
+                        }
+                    },
                     {
                         .Type       = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION,
                         .Flags      = D3D12_RESOURCE_BARRIER_FLAG_NONE,
@@ -640,14 +1221,45 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
                 ID3D12GraphicsCommandList_OMSetRenderTargets(CommandList, 1, &RtvDescriptorHandle, FALSE, NULL);
             }
 
-            // Record commands
+            // Upscale the scene into the back buffer
             {
-                const f32 ClearColor[] = { 0.05f, 0.05f, 0.05f, 1.0f };
-                ID3D12GraphicsCommandList_ClearRenderTargetView(CommandList, RtvDescriptorHandle, ClearColor, 0, NULL);
+                D3D12_VIEWPORT Viewport =
+                {
+                    .TopLeftX = 0.0f,
+                    .TopLeftY = 0.0f,
+                    .Width    = (f32)ResX,
+                    .Height   = (f32)ResY,
+                    .MinDepth = 0.0f,
+                    .MaxDepth = 0.0f
+                };
+                ID3D12GraphicsCommandList_RSSetViewports(CommandList, 1, &Viewport);
+
+                D3D12_RECT ScissorRectangle =
+                {
+                    .left   = 0,
+                    .top    = 0,
+                    .right  = ResX,
+                    .bottom = ResY
+                };
+                ID3D12GraphicsCommandList_RSSetScissorRects(CommandList, 1, &ScissorRectangle);
+
+                // Clamp to the center of the last rendered texel so filtering never reads outside the rendered region
+                f32 UpscaleConstants[] =
+                {
+                    (f32)RenderX / (f32)ResX,
+                    (f32)RenderY / (f32)ResY,
+                    ((f32)RenderX - 0.5f) / (f32)ResX,
+                    ((f32)RenderY - 0.5f) / (f32)ResY,
+                };
+
+                ID3D12GraphicsCommandList_SetPipelineState(CommandList, UpscalePSO);
+                ID3D12GraphicsCommandList_SetGraphicsRootSignature(CommandList, UpscaleRootSignature);
+                ID3D12GraphicsCommandList_SetDescriptorHeaps(CommandList, 1, &SrvDescriptorHeap);
+                ID3D12GraphicsCommandList_SetGraphicsRootDescriptorTable(CommandList, 0, SceneSrvDescriptorHandle);
+                ID3D12GraphicsCommandList_SetGraphicsRoot32BitConstants(CommandList, 1, ArrayCount(UpscaleConstants), UpscaleConstants, 0);
                 ID3D12GraphicsCommandList_IASetPrimitiveTopology(CommandList, D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-                ID3D12GraphicsCommandList_IASetVertexBuffers(CommandList, 0, 1, &VertexBufferView);
                 ID3D12GraphicsCommandList_DrawInstanced(CommandList, 3, 1, 0, 0);
-                
+
                 D3D12_RESOURCE_BARRIER ResourceBarriers[] = 
                 {
                     {
@@ -657,6 +1269,38 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
                         {
                             .pResource   = BackBuffers[BackBufferIndex],
                             .StateBefore = D3D12_RESOURCE_STATE_RENDER_TARGET,
+                            .StateAfter  = (CaptureSlot >= 0) ? D3D12_RESOURCE_STATE_COPY_SOURCE : D3D12_RESOURCE_STATE_PRESENT,
+                            .Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES
+                        }
+                    }
+                };
+                ID3D12GraphicsCommandList_ResourceBarrier(CommandList, ArrayCount(ResourceBarriers), ResourceBarriers);
+            }
+
+            // Copy the finished back buffer into the capture slot
+            if(CaptureSlot >= 0)
+            {
+                D3D12_TEXTURE_COPY_LOCATION Destination = {0};
+                Destination.pResource       = CaptureReadback;
+                Destination.Type            = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
+                Destination.PlacedFootprint = CaptureFootprints[CaptureSlot];
+
+                D3D12_TEXTURE_COPY_LOCATION Source = {0};
+                Source.pResource        = BackBuffers[BackBufferIndex];
+                Source.Type             = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+                Source.SubresourceIndex = 0;
+
+                ID3D12GraphicsCommandList_CopyTextureRegion(CommandList, &Destination, 0, 0, 0, &Source, NULL);
+
+                D3D12_RESOURCE_BARRIER ResourceBarriers[] = 
+                {
+                    {
+                        .Type       = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION,
+                        .Flags      = D3D12_RESOURCE_BARRIER_FLAG_NONE,
+                        .Transition = 
+                        {
+                            .pResource   = BackBuffers[BackBufferIndex],
+                            .StateBefore = D3D12_RESOURCE_STATE_COPY_SOURCE,
                             .StateAfter  = D3D12_RESOURCE_STATE_PRESENT,
                             .Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES
                         }
@@ -665,6 +1309,10 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
                 ID3D12GraphicsCommandList_ResourceBarrier(CommandList, ArrayCount(ResourceBarriers), ResourceBarriers);
             }
 
+            // End GPU frame timing and copy the timestamps to the readback buffer
+            ID3D12GraphicsCommandList_EndQuery(CommandList, TimestampQueryHeap, D3D12_QUERY_TYPE_TIMESTAMP, 2 * FrameIndex + 1);
+            ID3D12GraphicsCommandList_ResolveQueryData(CommandList, TimestampQueryHeap, D3D12_QUERY_TYPE_TIMESTAMP, 2 * FrameIndex, 2, TimestampReadback, 2 * FrameIndex * sizeof(u64));
+
             Result = ID3D12GraphicsCommandList_Close(CommandList);
             AssertHR(Result);
         }
@@ -675,6 +1323,12 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
             ID3D12CommandQueue_ExecuteCommandLists(DirectQueue, ArrayCount(CommandLists), (ID3D12CommandList **)CommandLists);
         }
 
+        // The copy completes together with the rest of the frame, at the next fence value
+        if(CaptureSlot >= 0)
+        {
+            FrameCaptureSubmit(&Capture, CaptureSlot, FenceValue, FrameNumber);
+        }
+
         // Present the frame
         {
             u32 SyncInterval = 1;
@@ -685,65 +1339,61 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
             AssertHR(Result);
         }
 
-        // Wait for the command queue to complete execution
+        // Signal the end of the frame and move on without waiting for the GPU
         {
-            u64 CurrentFenceValue = FenceValue;
-
-            // Issue signaling fence from the GPU.
-            // The fence is not signaled immediately but is only signaled once the GPU command queue has reached that point during execution.
-            // Any commands that have been queued before the signal method was invoked must complete execution before the fence will be signaled.
-            Result = ID3D12CommandQueue_Signal(DirectQueue, Fence, CurrentFenceValue);
+            Result = ID3D12CommandQueue_Signal(DirectQueue, Fence, FenceValue);
             AssertHR(Result);
 
-            ++FenceValue;
+            FrameFenceValues[FrameIndex] = FenceValue;
 
-            u64 Completed = ID3D12Fence_GetCompletedValue(Fence);
-            if(Completed < CurrentFenceValue)
+            // Finished capture copies are handed to the encoders from the fence service's waiter thread
+            if(CaptureSlot >= 0)
             {
-                // Specify event to be signaled when the fence reaches given value
-                Result = ID3D12Fence_SetEventOnCompletion(Fence, CurrentFenceValue, FenceEvent);
-                AssertHR(Result);
-
-                // Blocking wait util event is signaled
-                WaitForSingleObject(FenceEvent, INFINITE);
+                FenceServiceRegister(&FenceService, DirectFenceID, FenceValue, RetireCapturesOnFence, &Capture);
             }
 
+            ++FenceValue;
+
             BackBufferIndex = IDXGISwapChain3_GetCurrentBackBufferIndex(SwapChain);
             Assert(BackBufferIndex < ArrayCount(BackBuffers));
+
+            FrameIndex = (FrameIndex + 1) % (u32)ArrayCount(BackBuffers);
+            ++FrameNumber;
         }
     }
 
     //------------------------------------------------------------------------
     // - Shutdown
 
-    // Wait for the command queue to complete execution
+    // Wait for the command queue to complete execution, this also runs every outstanding fence callback
     {
-        u64 CurrentFenceValue = FenceValue;
-
-        // Issue signaling fence from the GPU.
-        // The fence is not signaled immediately but is only signaled once the GPU command queue has reached that point during execution.
-        // Any commands that have been queued before the signal method was invoked must complete execution before the fence will be signaled.
-        Result = ID3D12CommandQueue_Signal(DirectQueue, Fence, CurrentFenceValue);
+        Result = ID3D12CommandQueue_Signal(DirectQueue, Fence, FenceValue);
         AssertHR(Result);
 
+        FenceServiceWait(&FenceService, DirectFenceID, FenceValue);
         ++FenceValue;
 
-        u64 Completed = ID3D12Fence_GetCompletedValue(Fence);
-        if(Completed < CurrentFenceValue)
-        {
-            // Specify event to be signaled when the fence reaches given value
-            Result = ID3D12Fence_SetEventOnCompletion(Fence, CurrentFenceValue, FenceEvent);
-            AssertHR(Result);
-
-            // Blocking wait util event is signaled
-            WaitForSingleObject(FenceEvent, INFINITE);
-        }
-        BackBufferIndex = IDXGISwapChain3_GetCurrentBackBufferIndex(SwapChain);
+        FenceServiceShutdown(&FenceService);
     }
 
+    // GPU is idle and every capture has been retired, flush the encoders
+    FrameCaptureShutdown(&Capture);
+    WorkQueueShutdown(&CaptureWorkQueue);
+    D3D12_RANGE CaptureWrittenRange = {0};
+    ID3D12Resource_Unmap(CaptureReadback, 0, &CaptureWrittenRange);
+    ID3D12Resource_Release(CaptureReadback);
+
+    DrawQueueFree(&DrawQueue);
+    SceneFree(&Scene);
+    ID3D12Resource_Unmap(ObjectConstantsBuffer, 0, NULL);
+    ID3D12Resource_Release(ObjectConstantsBuffer);
+    WorkQueueShutdown(&WorkQueue);
+
     ID3D12Fence_Release(Fence);
-    CloseHandle(FenceEvent);
     ID3D12Resource_Release(VertexBuffer);
+    ID3D12Resource_Release(TimestampReadback);
+    ID3D12QueryHeap_Release(TimestampQueryHeap);
+    ID3D12Resource_Release(SceneTarget);
 
     for(u32 BufferIndex = 0; BufferIndex < ArrayCount(BackBuffers); ++BufferIndex)
     {
@@ -751,11 +1401,17 @@ int WINAPI WinMain(HINSTANCE Instance, HINSTANCE PrevInstance, PSTR CommandLine,
     }
 
     ID3D12GraphicsCommandList_Release(CommandList);
+    ID3D12PipelineState_Release(UpscalePSO);
+    ID3D12RootSignature_Release(UpscaleRootSignature);
     ID3D12PipelineState_Release(PSO);
     ID3D12RootSignature_Release(RootSignature);
+    ID3D12DescriptorHeap_Release(SrvDescriptorHeap);
     ID3D12DescriptorHeap_Release(RtvDescriptorHeap);
     IDXGISwapChain1_Release(SwapChain);
-    ID3D12CommandAllocator_Release(DirectQueueCommandAllocator);
+    for(u32 FrameSlot = 0; FrameSlot < ArrayCount(DirectQueueCommandAllocators); ++FrameSlot)
+    {
+        ID3D12CommandAllocator_Release(DirectQueueCommandAllocators[FrameSlot]);
+    }
     ID3D12CommandQueue_Release(DirectQueue);
     ID3D12Device_Release(Device);
     IDXGIAdapter1_Release(Adapter);
@@ -0,0 +1,163 @@
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+// Fixed size pool of worker threads pulling callbacks from a ring of entries.
+// Meant for coarse jobs (a handful per dispatch), so a single mutex guards the ring.
+// The thread calling WorkQueueCompleteAll helps out instead of sleeping.
+
+#include "base.h"
+#include "threading.h"
+
+#define WORK_QUEUE_MAX_ENTRIES 256
+#define WORK_QUEUE_MAX_THREADS 64
+
+typedef void work_queue_callback(void *Data);
+
+typedef struct work_queue_entry
+{
+    work_queue_callback *Callback;
+    void *Data;
+} work_queue_entry;
+
+typedef struct work_queue
+{
+    platform_mutex Mutex;
+    platform_condvar WorkAvailable;
+    platform_condvar WorkCompleted;
+
+    work_queue_entry Entries[WORK_QUEUE_MAX_ENTRIES];
+    u32 ReadIndex;
+    u32 WriteIndex;
+    u32 PendingCount; // Added but not yet completed
+    b32 Quit;
+
+    u32 ThreadCount;
+    platform_thread Threads[WORK_QUEUE_MAX_THREADS];
+} work_queue;
+
+// Must be called with the mutex held and at least one entry queued
+static work_queue_entry WorkQueuePopLocked(work_queue *Queue)
+{
+    Assert(Queue->ReadIndex != Queue->WriteIndex);
+    work_queue_entry Entry = Queue->Entries[Queue->ReadIndex];
+    Queue->ReadIndex = (Queue->ReadIndex + 1) % WORK_QUEUE_MAX_ENTRIES;
+    return Entry;
+}
+
+static void WorkQueueFinishEntry(work_queue *Queue)
+{
+    PlatformMutexLock(&Queue->Mutex);
+    Assert(Queue->PendingCount > 0);
+    if(--Queue->PendingCount == 0)
+    {
+        PlatformCondvarBroadcast(&Queue->WorkCompleted);
+    }
+    PlatformMutexUnlock(&Queue->Mutex);
+}
+
+PLATFORM_THREAD_PROC(WorkQueueThreadProc)
+{
+    work_queue *Queue = (work_queue *)Parameter;
+    for(;;)
+    {
+        PlatformMutexLock(&Queue->Mutex);
+        while(!Queue->Quit && Queue->ReadIndex == Queue->WriteIndex)
+        {
+            PlatformCondvarWait(&Queue->WorkAvailable, &Queue->Mutex);
+        }
+        if(Queue->ReadIndex == Queue->WriteIndex)
+        {
+            // Quit requested and nothing left to do
+            PlatformMutexUnlock(&Queue->Mutex);
+            break;
+        }
+        work_queue_entry Entry = WorkQueuePopLocked(Queue);
+        PlatformMutexUnlock(&Queue->Mutex);
+
+        Entry.Callback(Entry.Data);
+        WorkQueueFinishEntry(Queue);
+    }
+    PLATFORM_THREAD_PROC_END();
+}
+
+// ThreadCount of 0 is valid, all work then runs inside WorkQueueCompleteAll
+static void WorkQueueInit(work_queue *Queue, u32 ThreadCount)
+{
+    Assert(ThreadCount <= WORK_QUEUE_MAX_THREADS);
+
+    Queue->ReadIndex    = 0;
+    Queue->WriteIndex   = 0;
+    Queue->PendingCount = 0;
+    Queue->Quit         = 0;
+    Queue->ThreadCount  = ThreadCount;
+
+    PlatformMutexInit(&Queue->Mutex);
+    PlatformCondvarInit(&Queue->WorkAvailable);
+    PlatformCondvarInit(&Queue->WorkCompleted);
+
+    for(u32 ThreadIndex = 0; ThreadIndex < ThreadCount; ++ThreadIndex)
+    {
+        PlatformThreadCreate(&Queue->Threads[ThreadIndex], WorkQueueThreadProc, Queue);
+    }
+}
+
+static void WorkQueueAdd(work_queue *Queue, work_queue_callback *Callback, void *Data)
+{
+    PlatformMutexLock(&Queue->Mutex);
+
+    u32 NextWriteIndex = (Queue->WriteIndex + 1) % WORK_QUEUE_MAX_ENTRIES;
+    Assert(NextWriteIndex != Queue->ReadIndex && "Work queue is full");
+
+    Queue->Entries[Queue->WriteIndex].Callback = Callback;
+    Queue->Entries[Queue->WriteIndex].Data     = Data;
+    Queue->WriteIndex = NextWriteIndex;
+    ++Queue->PendingCount;
+
+    PlatformCondvarSignal(&Queue->WorkAvailable);
+    PlatformMutexUnlock(&Queue->Mutex);
+}
+
+static void WorkQueueCompleteAll(work_queue *Queue)
+{
+    PlatformMutexLock(&Queue->Mutex);
+    while(Queue->PendingCount > 0)
+    {
+        if(Queue->ReadIndex != Queue->WriteIndex)
+        {
+            work_queue_entry Entry = WorkQueuePopLocked(Queue);
+            PlatformMutexUnlock(&Queue->Mutex);
+
+            Entry.Callback(Entry.Data);
+            WorkQueueFinishEntry(Queue);
+
+            PlatformMutexLock(&Queue->Mutex);
+        }
+        else
+        {
+            PlatformCondvarWait(&Queue->WorkCompleted, &Queue->Mutex);
+        }
+    }
+    PlatformMutexUnlock(&Queue->Mutex);
+}
+
+// Finishes all queued work, then stops the worker threads
+static void WorkQueueShutdown(work_queue *Queue)
+{
+    WorkQueueCompleteAll(Queue);
+
+    PlatformMutexLock(&Queue->Mutex);
+    Queue->Quit = 1;
+    PlatformCondvarBroadcast(&Queue->WorkAvailable);
+    PlatformMutexUnlock(&Queue->Mutex);
+
+    for(u32 ThreadIndex = 0; ThreadIndex < Queue->ThreadCount; ++ThreadIndex)
+    {
+        PlatformThreadJoin(&Queue->Threads[ThreadIndex]);
+    }
+
+    PlatformCondvarDestroy(&Queue->WorkCompleted);
+    PlatformCondvarDestroy(&Queue->WorkAvailable);
+    PlatformMutexDestroy(&Queue->Mutex);
+}
+
+#endif